@@ -14,25 +14,54 @@
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <dirent.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/fs.h>		//...FICLONE
+#endif
 
 #include <iomanip>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <string_view>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <zlib.h>
 
 #include "cb_database.h"
 
 using namespace std;
 
-#define N_BUF 1000000
+#define CB_ARENA_BLOCK	65536	//...Bytes per string arena block
+#define CB_STRING_RESTART	16	//...Strings per front-coded block
+#define CB_PARALLEL_STRINGS	4096	//...Strings per chunk for a thread
+#define CB_DIRECTIONS_BLOCK	8192	//...Bytes of text per directions block
+#define CB_DICTIONARY_SIZE	16384	//...Bytes of the directions dictionary
+#define CB_DICTIONARY_WORDS	4	//...Longest phrase in the dictionary
+#define CB_MIN_SLOTS	1024	//...Initial hash slots of a string table
+#define CB_LEGACY_DATA	0634000	//...Where the records of an original file begin
 
+//...Table of the strings that do not belong to a book
 CB_StringTable theStringTable;
-CB_StringTable*	CB_String::_theStringTable_p = &theStringTable;
+thread_local CB_StringTable* CB_String::_theStringTable_p = &theStringTable;
 
 //PAGE
 // ************************************************************************
 std::ostream&
 operator << (
     std::ostream&		o,
-    const CB_String	s
+    CB_StringRef		s
 )
 // ************************************************************************
 {
@@ -45,7 +74,7 @@ operator << (
 CB_String::CB_String()
 // ************************************************************************
 {
-    _itor = _theStringTable_p -> Insert( "", 0 );
+    _address = _theStringTable_p -> InsertEmpty();
 }
 
 //PAGE
@@ -55,8 +84,7 @@ CB_String::CB_String(
 )
 // ************************************************************************
 {
-    _itor = _theStringTable_p -> Insert( s, strlen(s) );
-    assert( (*_itor).second.refCount > 0 );
+    _address = _theStringTable_p -> Insert( s, strlen(s) );
 }
 
 //PAGE
@@ -67,8 +95,18 @@ CB_String::CB_String(
 )
 // ************************************************************************
 {
-    _itor = _theStringTable_p -> Insert( s, l );
-    assert( (*_itor).second.refCount > 0 );
+    _address = _theStringTable_p -> Insert( s, l );
+}
+
+//PAGE
+// ************************************************************************
+CB_String::CB_String(
+    CB_StringRef	s
+)
+// ************************************************************************
+{
+    _address = s._address;
+    AddReference();
 }
 
 //PAGE
@@ -76,11 +114,7 @@ CB_String::CB_String(
 CB_String::~CB_String()
 // ************************************************************************
 {
-    assert( (*_itor).second.refCount > 0 );
-    (*_itor).second.refCount--;
-    if ( (*_itor).second.refCount == 0 ) {
-	_theStringTable_p -> Erase( _itor );
-    }
+    Release();
 }
 
 //PAGE
@@ -90,9 +124,8 @@ CB_String::CB_String(
 )
 // ************************************************************************
 {
-    _itor = o._itor;
-    (*_itor).second.refCount++;
-    assert( (*_itor).second.refCount > 1 );
+    _address = o._address;
+    AddReference();
 }
 
 //PAGE
@@ -103,51 +136,407 @@ CB_String::operator=(
 )
 // ************************************************************************
 {
+    //...Reference the new string first: o may be this object
+    o.AddReference();
+
     //...Delete the current reference of this object
-    assert( (*_itor).second.refCount > 0 );
-    (*_itor).second.refCount--;
-    if ( (*_itor).second.refCount == 0 ) {
-	_theStringTable_p -> Erase( _itor );
-    }
+    Release();
 
-    _itor = o._itor;
-    (*_itor).second.refCount++;
+    _address = o._address;
     return *this;
 }
 
 //PAGE
 // ************************************************************************
-CB_StringTable_t::iterator
+void
+CB_String::AddReference() const
+// ************************************************************************
+{
+    if ( _theStringTable_p -> _isImmortal ) {
+	return;
+    }
+
+    CB_StringData& data = Data();
+    data.refCount++;
+    assert( data.refCount > 1 );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_String::Release()
+// ************************************************************************
+{
+    if ( _address == CB_NO_ADDRESS || _theStringTable_p -> _isImmortal ) {
+	return;
+    }
+
+    CB_StringData& data = Data();
+    assert( data.refCount > 0 );
+    data.refCount--;
+    if ( data.refCount == 0 ) {
+	_theStringTable_p -> Erase( _address );
+    }
+}
+
+//PAGE
+// ************************************************************************
+uint32_t
+CB_StringTable::Hash(
+    const char*	s,
+    size_t	l
+)
+// ************************************************************************
+{
+    //...32 bit FNV-1a
+    uint32_t h = 2166136261U;
+    const unsigned char* p = (const unsigned char*) s;
+    const unsigned char* pEnd = p + l;
+
+    for ( ; p != pEnd ; p++ ) {
+	h ^= *p;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+//PAGE
+// ************************************************************************
+size_t
+CB_StringTable::FindSlot(
+    const char*	s,
+    size_t	l,
+    uint32_t	hash
+) const
+// ************************************************************************
+//
+// Returns the slot holding the string, or the empty slot
+// where it would be inserted. There must be at least one empty slot.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t mask = _slots.size() - 1;
+    size_t slot = hash & mask;
+
+    for ( ; _slots[ slot ].address1 != 0 ; slot = (slot + 1) & mask ) {
+	if ( _slots[ slot ].hash != hash ) {
+	    continue;
+	}
+	const CB_StringData& data = _byAddress[ _slots[ slot ].address1 - 1 ];
+	if ( data.length == l && memcmp( data.string_p, s, l ) == 0 ) {
+	    break;
+	}
+    }
+    return slot;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_StringTable::InsertSlot(
+    CB_Address_t	address,
+    uint32_t		hash
+)
+// ************************************************************************
+{
+    //...Keep the load factor at or below 1/2
+    if ( (_size + 1) * 2 > _slots.size() ) {
+	Rehash( _slots.empty() ? CB_MIN_SLOTS : _slots.size() * 2 );
+    }
+
+    size_t mask = _slots.size() - 1;
+    size_t slot = hash & mask;
+    while ( _slots[ slot ].address1 != 0 ) {
+	slot = (slot + 1) & mask;
+    }
+    _slots[ slot ].address1 = address + 1;
+    _slots[ slot ].hash = hash;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_StringTable::EraseSlot(
+    CB_Address_t	address
+)
+// ************************************************************************
+{
+    const CB_StringData& data = _byAddress[ address ];
+
+    size_t mask = _slots.size() - 1;
+    size_t slot = Hash( data.string_p, data.length ) & mask;
+    while ( _slots[ slot ].address1 != address + 1 ) {
+	assert( _slots[ slot ].address1 != 0 );
+	slot = (slot + 1) & mask;
+    }
+
+    //...Shift back the rest of the probe run into the hole
+    size_t hole = slot;
+    for ( slot = (slot + 1) & mask ; _slots[ slot ].address1 != 0 ;
+					slot = (slot + 1) & mask ) {
+	size_t home = _slots[ slot ].hash & mask;
+	if ( ((slot - home) & mask) >= ((slot - hole) & mask) ) {
+	    _slots[ hole ] = _slots[ slot ];
+	    hole = slot;
+	}
+    }
+    _slots[ hole ].address1 = 0;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_StringTable::Rehash(
+    size_t	nSlots
+)
+// ************************************************************************
+{
+    std::vector< CB_StringSlot > oldSlots( nSlots, CB_StringSlot() );
+    oldSlots.swap( _slots );
+
+    size_t mask = nSlots - 1;
+    std::vector< CB_StringSlot >::const_iterator iSlot = oldSlots.begin();
+    std::vector< CB_StringSlot >::const_iterator iSlotEnd = oldSlots.end();
+
+    for ( ; iSlot != iSlotEnd ; iSlot++ ) {
+	if ( (*iSlot).address1 == 0 ) {
+	    continue;
+	}
+	size_t slot = (*iSlot).hash & mask;
+	while ( _slots[ slot ].address1 != 0 ) {
+	    slot = (slot + 1) & mask;
+	}
+	_slots[ slot ] = (*iSlot);
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_StringTable::BuildSlots()
+// ************************************************************************
+//
+// Build the hash slots of the strings read by CB_Stream, which enters
+// them without slots.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t nSlots = CB_MIN_SLOTS;
+    while ( nSlots < (_size + 1) * 2 ) {
+	nSlots *= 2;
+    }
+    _slots.assign( nSlots, CB_StringSlot() );
+
+    size_t mask = nSlots - 1;
+    CB_Address_t address;
+    CB_Address_t nAddress = _byAddress.size();
+    for ( address = 0 ; address < nAddress ; address++ ) {
+	const CB_StringData& data = _byAddress[ address ];
+	if ( data.string_p == NULL ) {
+	    continue;
+	}
+	uint32_t hash = Hash( data.string_p, data.length );
+	size_t slot = hash & mask;
+	while ( _slots[ slot ].address1 != 0 ) {
+	    slot = (slot + 1) & mask;
+	}
+	_slots[ slot ].address1 = address + 1;
+	_slots[ slot ].hash = hash;
+    }
+}
+
+//PAGE
+// ************************************************************************
+const char*
+CB_StringArena::Allocate(
+    const char*	s,
+    size_t	l
+)
+// ************************************************************************
+{
+    if ( l + 1 > left ) {
+	size_t blockSize = max( (size_t) CB_ARENA_BLOCK, l + 1 );
+	blocks.push_back( std::unique_ptr< char[] >( new char[ blockSize ] ) );
+	next_p = blocks.back().get();
+	left = blockSize;
+    }
+
+    char* result = next_p;
+    memcpy( result, s, l );
+    result[ l ] = '\0';
+
+    next_p += l + 1;
+    left -= l + 1;
+    return result;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_StringArena::Adopt(
+    CB_StringArena&	o
+)
+// ************************************************************************
+//
+// Take over the blocks of another arena, which is left empty. New
+// strings still go into the current block of this one.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::vector< std::unique_ptr< char[] > >::iterator iBlk = o.blocks.begin();
+    std::vector< std::unique_ptr< char[] > >::iterator iBlkEnd = o.blocks.end();
+
+    for ( ; iBlk != iBlkEnd ; iBlk++ ) {
+	blocks.push_back( std::move( *iBlk ) );
+    }
+    o.Clear();
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_StringArena::Clear()
+// ************************************************************************
+{
+    blocks.clear();
+    next_p = NULL;
+    left = 0;
+}
+
+//PAGE
+// ************************************************************************
+CB_Address_t
 CB_StringTable::Insert(
     const char*	s,
     size_t	l
 )
 // ************************************************************************
 {
-    //...Insert the string into the string table (or find it there)
-    pair< CB_StringTable_t::iterator, bool > result =
-		_byString.insert( CB_StringTable_t::value_type(
-					string(s,l), CB_StringData() ) );
+    uint32_t hash = Hash( s, l );
+
+    if ( _slots.empty() ) {
+	BuildSlots();
+    }
+
+    //...Find the string in the string table
+    size_t slot = FindSlot( s, l, hash );
+    if ( _slots[ slot ].address1 != 0 ) {
+	CB_Address_t address = _slots[ slot ].address1 - 1;
+	if ( !_isImmortal ) {
+	    _byAddress[ address ].refCount++;
+	}
+	return address;
+    }
 
-    CB_StringTable_t::iterator itor = result.first;
-    
     //...Next free address
-    size_t address;
+    CB_Address_t address;
     if ( _freeAddresses.empty() ) {
 	address = _byAddress.size();
-	_byAddress.push_back( CB_StringTable_t::iterator() );
+	_byAddress.push_back( CB_StringData() );
     }
     else {
 	address = _freeAddresses.back();
 	_freeAddresses.pop_back();
     }
 
-    (*itor).second.refCount++;
-    (*itor).second.address = address;
+    //...Insert the string into the string table
+    CB_StringData& data = _byAddress[ address ];
+    data.string_p = _arena.Allocate( s, l );
+    data.length = l;
+    data.refCount = 1;
+
+    InsertSlot( address, hash );
+    _size++;
+
+    if ( l == 0 ) {
+	_emptyAddress = address;
+    }
+    return address;
+}
+
+//PAGE
+// ************************************************************************
+CB_Address_t
+CB_StringTable::InsertEmpty()
+// ************************************************************************
+//
+// Insert( "", 0 ) without the lookup: every new CB_String starts as "".
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    if ( _emptyAddress == CB_NO_ADDRESS ) {
+	return Insert( "", 0 );
+    }
+
+    if ( !_isImmortal ) {
+	_byAddress[ _emptyAddress ].refCount++;
+    }
+    return _emptyAddress;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_StringTable::Erase(
+    CB_Address_t	address
+)
+// ************************************************************************
+{
+    CB_StringData& data = _byAddress[ address ];
+    assert( data.refCount == 0 );
+    if ( !_slots.empty() ) {
+	EraseSlot( address );
+    }
+    _size--;
+
+    if ( address == _emptyAddress ) {
+	_emptyAddress = CB_NO_ADDRESS;
+    }
+
+    data.string_p = NULL;
+    data.length = 0;
+    _freeAddresses.push_back( address );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_StringTable::Clear()
+// ************************************************************************
+{
+    _size = 0;
+    _emptyAddress = CB_NO_ADDRESS;
+    _isImmortal = false;
+    _slots.clear();
+    _byAddress.clear();
+    _freeAddresses.clear();
+
+    _arena.Clear();
+}
 
-    _byAddress[ address ] = itor;
+//PAGE
+// ************************************************************************
+std::vector< CB_Address_t >
+CB_StringTable::SortedAddresses() const
+// ************************************************************************
+{
+    std::vector< CB_Address_t > result;
+    result.reserve( _size );
+
+    CB_Address_t address;
+    CB_Address_t nAddress = _byAddress.size();
+    for ( address = 0 ; address < nAddress ; address++ ) {
+	if ( _byAddress[ address ].string_p != NULL ) {
+	    result.push_back( address );
+	}
+    }
 
-    return itor;
+    const CB_StringData* data_p = _byAddress.data();
+    stable_sort( result.begin(), result.end(),
+	[ data_p ]( CB_Address_t a1, CB_Address_t a2 ) {
+	    return strcmp( data_p[ a1 ].string_p, data_p[ a2 ].string_p ) < 0;
+	} );
+    return result;
 }
 
 //PAGE
@@ -158,13 +547,16 @@ CB_StringTable::Print(
 )
 // ************************************************************************
 {
-    CB_StringTable_t::iterator iStr = _byString.begin();
-    CB_StringTable_t::iterator iStrEnd = _byString.end();
+    std::vector< CB_Address_t > sorted = SortedAddresses();
+
+    std::vector< CB_Address_t >::iterator iStr = sorted.begin();
+    std::vector< CB_Address_t >::iterator iStrEnd = sorted.end();
 
     for ( ; iStr != iStrEnd; iStr++ ) {
-	o << setw(5) << (*iStr).second.refCount << " " <<
-	     setw(5) << (*iStr).first.size() << " " <<
-			'"' << (*iStr).first << '"' << endl;
+	const CB_StringData& data = _byAddress[ *iStr ];
+	o << setw(5) << data.refCount << " " <<
+	     setw(5) << data.length << " " <<
+			'"' << data.string_p << '"' << endl;
     }
 }
 
@@ -198,8 +590,85 @@ CB_Recipe::Clear()
     _ingredients.clear();
 
     _directions.clear();
+    delete _lazy_p;
+    _lazy_p = NULL;
 };
 
+//PAGE
+// ************************************************************************
+CB_RecipeLinks&
+CB_Recipe::Links()
+// ************************************************************************
+//
+// Those of a recipe in a book, made when it is first put in one.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    if ( _links_p == NULL ) {
+	_links_p = new CB_RecipeLinks;
+    }
+    return *_links_p;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Recipe::AddEntry(
+    size_t			index,
+    CB_RecipeMap_t::iterator	iEntry
+)
+// ************************************************************************
+//
+// Add an entry of the recipe in index CB_Book::INDEX_... index to those
+// it has there. The indices are mostly built in that order, which makes
+// it an append.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_RecipeLinks& links = Links();
+    size_t end = 0;
+    size_t i;
+    for ( i = 0 ; i <= index ; i++ ) {
+	end += links.nEntries[i];
+    }
+    links.entries.insert( links.entries.begin() + end, iEntry );
+    links.nEntries[ index ]++;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Recipe::Decode() const
+// ************************************************************************
+//
+// Decode the ingredients and directions of a lazily read recipe. The
+// input was checked when the recipe was read.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::unique_ptr< CB_LazyRecipe > lazy_p( _lazy_p );
+    _lazy_p = NULL;
+
+    CB_StringTableScope scope( *lazy_p -> table_p );
+    CB_Stream stream( lazy_p -> begin_p, lazy_p -> end_p - lazy_p -> begin_p,
+							lazy_p -> encoding );
+    stream.Set_directionSource( lazy_p -> directionSource_p );
+
+    size_t nIngredients;
+    size_t nDirections;
+    stream >> nIngredients;
+    stream >> nDirections;
+
+    //...Past the single strings
+    size_t i;
+    for ( i = 0 ; i < 7 ; i++ ) {
+	size_t address;
+	stream >> address;
+    }
+    stream.GetRecipeBody( const_cast< CB_Recipe& >( *this ),
+						nIngredients, nDirections );
+}
+
 //PAGE
 // ************************************************************************
 void
@@ -211,6 +680,8 @@ CB_Recipe::Print(
     size_t i;
     size_t n;
 
+    Materialize();
+
     size_t delimLen = 40;
     size_t nameLen = _name.size();
     size_t leftLen = 0;
@@ -276,6 +747,8 @@ CB_Recipe::PrintDirections(
 )
 // ************************************************************************
 {
+    Materialize();
+
     vector< CB_String >::iterator iDir = _directions.begin();
     vector< CB_String >::iterator iDirEnd = _directions.end();
 
@@ -300,6 +773,7 @@ CB_Recipe::Copy(
     _category4 = o._category4;
     _date = o._date;
 
+    o.Materialize();
     CB_Ingredient_pVector_t::const_iterator iIng = o._ingredients.begin();
     CB_Ingredient_pVector_t::const_iterator iIngEnd = o._ingredients.end();
 
@@ -317,584 +791,4353 @@ CB_Recipe::Copy(
 
 //PAGE
 // ************************************************************************
-void
-CB_Book::Read(
-    const char*	fName
-)
+CB_Book::~CB_Book()
 // ************************************************************************
 {
+    CB_StringTableScope scope( _stringTable );
     Clear();
-    theStringTable.Clear();
-
-    CB_Stream stream( fName, "rb" );
-    stream >> theStringTable;
-    stream >> *this;
-
-    Index();
 }
 
 //PAGE
 // ************************************************************************
-void
-CB_Book::Write(
-    char*	fName
+bool
+CB_Book::Read(
+    const char*		fName,
+    unsigned int	flags
 )
 // ************************************************************************
 {
-    CB_Stream stream( fName, "wb" );
-    stream << theStringTable;
-    stream << *this;
-}
+    CB_StringTableScope scope( _stringTable );
 
-//PAGE
-// ************************************************************************
-void
-CB_Book::MakeBackup(
-    char*	fName
-)
-// ************************************************************************
-{
-    string backupName("backup_");
-    backupName += fName;
+    Clear();
+    _stringTable.Clear();
+    _stringTable.Set_isImmortal( (flags & READ_ONLY) != 0 );
 
-    cout << backupName << endl;
+    _source_p.reset( new CB_Stream( fName, "rb" ) );
+    CB_Stream& stream = *_source_p;
+    stream.Set_isLazy( (flags & READ_LAZY) != 0 );
 
-    // Open the file in binary mode, so that no weird translation happens
-    FILE* inFile = fopen(fName,"rb");
-    FILE* outFile = fopen(backupName.c_str(),"wb");
+    unsigned int nThreads = NThreads();
+    bool isValid = stream.ReadHeader( true, nThreads );
+    bool isIndexed = false;
 
-    if ( inFile == NULL ) {
-	printf("Cannot open the input file %s\n",fName);
-    }
-    if ( inFile == NULL ) {
-	printf("Cannot open the output file %s\n",backupName.c_str() );
+    if ( isValid && stream.Get_version() == 1 ) {
+	stream >> _stringTable;
+	if ( stream.Good() ) {
+	    stream >> *this;
+	}
+	isValid = stream.Good();
     }
+    else if ( isValid ) {
+	//...The recipe index is optional: it only lets threads share the work
+	std::vector< size_t > offsets;
+	if ( nThreads > 1 ) {
+	    ReadRecipeOffsets( stream, offsets );
+	}
 
-    unsigned char buf[N_BUF];
-    int n;
-    while ( (n = fread(buf,1,N_BUF,inFile) ) > 0 ) {
-	fwrite(buf,1,n,outFile);
+	//...The strings and recipes sections are required
+	isValid = stream.SelectSection( CB_Stream::SECTION_STRINGS ) &&
+		  stream.GetStringTable( _stringTable, nThreads ) &&
+		  stream.SelectSection( CB_Stream::SECTION_RECIPES ) &&
+		  stream.GetRecipes( *this, offsets, nThreads );
+	isIndexed = isValid &&
+		    stream.SelectSection( CB_Stream::SECTION_INDEXES ) &&
+		    ReadIndexes( stream );
     }
 
-    fclose( inFile );
-    fclose( outFile );
-}
+    if ( !isValid ) {
+	fprintf( stderr, "%s: not a valid cookbook file\n", fName );
 
-//PAGE
-// ************************************************************************
-void
-CB_Book::Clear()
-// ************************************************************************
-{
-    CB_Recipe_pVector_t::iterator iRec = _recipes.begin();
-    CB_Recipe_pVector_t::iterator iRecEnd = _recipes.end();
+	//...The reference counts cannot be trusted: drop it all
+	_stringTable.Set_isImmortal();
+	Clear();
+	_stringTable.Clear();
+	return false;
+    }
 
-    for ( ; iRec != iRecEnd ; iRec++ ) {
-	delete (*iRec);
+    if ( !isIndexed ) {
+	Index( nThreads );
+    }
+    CompactRecipes();
+
+    //...The ids are optional: without them, the recipes are numbered
+    bool hasIds = stream.Get_version() != 1 &&
+		  stream.SelectSection( CB_Stream::SECTION_RECIPE_IDS );
+    if ( !hasIds || !ReadRecipeIds( stream ) ) {
+	if ( hasIds ) {
+	    fprintf( stderr, "%s: recipe ids not valid, renumbered\n", fName );
+	}
+	NumberRecipeIds();
     }
 
-    _recipes.clear();
+    //...Changes since the file was written
+    _fileName = fName;
+    _journalName = JournalName( fName );
+    struct stat st;
+    bool hasJournal = stat( _journalName.c_str(), &st ) == 0;
+    if ( hasJournal || (flags & READ_JOURNAL) != 0 ) {
+	_fingerprint = stream.Fingerprint();
+    }
+    if ( hasJournal ) {
+	ReplayJournal( (flags & READ_JOURNAL) != 0 );
+    }
+    _isJournaling = (flags & READ_JOURNAL) != 0;
 
-    _sortedByName.clear();
-    _sortedByCategory.clear();
-    _sortedByIngredient.clear();
+    if ( (flags & READ_LAZY) == 0 ) {
+	_source_p.reset();
+    }
+    return true;
 }
 
 //PAGE
 // ************************************************************************
-void
-CB_Book::Add(
-    CB_Recipe*	recipe_p
+size_t
+CB_Book::Write(
+    char*		fName,
+    unsigned int	flags
 )
 // ************************************************************************
+//
+// Returns the number of bytes written, 0 if the file could not be written.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    //...Add it to the book
-    _recipes.push_back( recipe_p );
-    IndexRecipe( recipe_p );
+    CB_StringTableScope scope( _stringTable );
+    CompactRecipes();
+
+    //...Count the references that the file itself holds: a read only
+    //...book keeps no counts, and the indices reference the strings again
+    //...when the file is read.
+    //...Compressed directions are not in the string table of the file
+    bool isCompressed = (flags & WRITE_COMPRESSED) != 0 &&
+						(flags & WRITE_V1) == 0;
+
+    std::vector< uint32_t > refCounts;
+    CountReferences( refCounts, !isCompressed );
+
+    std::vector< CB_Address_t > addressMap;
+    if ( flags & WRITE_COMPACT ) {
+	CompactAddresses( addressMap, !isCompressed );
+    }
+
+    bool isInPlace = (flags & WRITE_IN_PLACE) != 0;
+    CB_Stream stream( fName, isInPlace ? "wb" : "sb" );
+    if ( flags & WRITE_COMPACT ) {
+	stream.Set_addressMap( &addressMap );
+    }
+
+    if ( flags & WRITE_V1 ) {
+	stream.PutStringTable( _stringTable, &refCounts );
+	stream << *this;
+    }
+    else {
+	stream.BeginContainer();
+
+	uint32_t encoding = (flags & WRITE_VARINT) ?
+					CB_Stream::ENCODING_VARINT : 0;
+
+	stream.BeginSection( CB_Stream::SECTION_STRINGS, encoding |
+			((flags & WRITE_FRONT_CODED) ?
+				CB_Stream::ENCODING_FRONT_CODED : 0) );
+	stream.PutStringTable( _stringTable, &refCounts );
+	stream.EndSection();
+
+	std::vector< size_t > offsets;
+	stream.BeginSection( CB_Stream::SECTION_RECIPES, encoding |
+			(isCompressed ?
+				CB_Stream::ENCODING_DIRECTION_BLOCKS : 0) );
+	WriteRecipes( stream, offsets );
+	stream.EndSection();
+
+	if ( isCompressed ) {
+	    std::string dictionary;
+	    TrainDictionary( dictionary );
+
+	    stream.BeginSection( CB_Stream::SECTION_DIRECTIONS, encoding );
+	    if ( !stream.PutDirections( dictionary ) ) {
+		fprintf( stderr, "%s: cannot compress the directions\n", fName );
+		return 0;
+	    }
+	    stream.EndSection();
+	}
+
+	stream.BeginSection( CB_Stream::SECTION_RECIPE_INDEX, encoding );
+	WriteRecipeIndex( stream, offsets );
+	stream.EndSection();
+
+	stream.BeginSection( CB_Stream::SECTION_RECIPE_IDS, encoding );
+	WriteRecipeIds( stream );
+	stream.EndSection();
+
+	if ( flags & WRITE_INDEXES ) {
+	    stream.BeginSection( CB_Stream::SECTION_INDEXES, encoding );
+	    WriteIndexes( stream, refCounts );
+	    stream.EndSection();
+	}
+
+	stream.EndContainer();
+    }
+
+    //...All of the book is in the file of the book: no journal. The
+    //...fingerprint is taken before the output is flushed, and kept
+    //...only once the file is written
+    bool isCompacting = !_fileName.empty() && _fileName == fName;
+    uint32_t fingerprint = isCompacting ? stream.Fingerprint() : 0;
+
+    if ( !(isInPlace ? stream.Flush() : stream.Commit()) ) {
+	fprintf( stderr, "%s: cannot write the cookbook file\n", fName );
+	return 0;
+    }
+    if ( isCompacting ) {
+	_fingerprint = fingerprint;
+    }
+
+    if ( isCompacting && unlink( _journalName.c_str() ) != 0 &&
+							errno != ENOENT ) {
+	perror( _journalName.c_str() );
+    }
+    return stream.Get_bytesWritten();
 }
 
 //PAGE
 // ************************************************************************
-void
-CB_Book::Delete(
-    CB_Recipe*	recipe_p
+size_t
+CB_Book::Compact(
+    unsigned int	flags
 )
 // ************************************************************************
+//
+// Fold the journal into the file of the book: write all of the book to
+// the file it was read from, never in place and with the strings
+// renumbered (WRITE_COMPACT). Returns the bytes written,
+// 0 if the book was not read from a file or cannot be written.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    //...Delete references to it from the indices
-    DeleteFromMap( recipe_p, _sortedByName );
-    DeleteFromMap( recipe_p, _sortedByCategory );
-    DeleteFromMap( recipe_p, _sortedByIngredient );
-
-    //...Delete it from the list of recipes
-    CB_Recipe_pVector_t::iterator itor = find (
-				_recipes.begin(), _recipes.end(), recipe_p );
-    assert ( itor != _recipes.end() );
-    _recipes.erase( itor );
-
-    delete recipe_p;
+    if ( _fileName.empty() ) {
+	return 0;
+    }
+    return Write( &_fileName[0], (flags & ~WRITE_IN_PLACE) | WRITE_COMPACT );
 }
 
 //PAGE
 // ************************************************************************
-void
-CB_Book::Print(
-    std::ostream& o
+size_t
+CB_Book::Freeze(
+    const char*	fName
 )
 // ************************************************************************
+//
+// Write the book as a frozen book image (see CB_FrozenBook): every
+// recipe decoded, and every index built. Each distinct string is
+// stored once. Returns the number of bytes written, 0 if the file
+// could not be written.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
+    CB_StringTableScope scope( _stringTable );
+    IndexIngredients();
+    CompactRecipes();
+
+    //...The characters of the strings, each distinct one once
+    std::string strings( 1, '\0' );
+    std::unordered_map< std::string_view, uint32_t > stringOffsets;
+    bool isTooLarge = false;
+
+    auto freeze = [ & ]( CB_StringRef s ) {
+	CB_FrozenString frozen = { 0, (uint32_t) s.size() };
+	if ( s.size() == 0 ) {
+	    return frozen;
+	}
+	std::string_view chars( s.c_str(), s.size() );
+	std::unordered_map< std::string_view, uint32_t >::const_iterator
+				    iStr = stringOffsets.find( chars );
+	if ( iStr != stringOffsets.end() ) {
+	    frozen.offset = (*iStr).second;
+	    return frozen;
+	}
+	if ( strings.size() + chars.size() >= UINT32_MAX ) {
+	    isTooLarge = true;
+	    return frozen;
+	}
+	frozen.offset = strings.size();
+	strings.append( chars );
+	strings.push_back( '\0' );
+	stringOffsets[ chars ] = frozen.offset;
+	return frozen;
+    };
+
+    //...Recipes, with their ingredients and directions
     size_t i;
     size_t nRecipe = _recipes.size();
+    std::vector< CB_FrozenRecipe > recipes( nRecipe );
+    std::vector< CB_FrozenIngredient > ingredients;
+    std::vector< CB_FrozenString > directions;
+    std::unordered_map< const CB_Recipe*, uint32_t > recipeNos;
+
     for ( i = 0 ; i < nRecipe ; i++ ) {
-	o << endl;
-	_recipes[i] -> Print(o);
+	CB_Recipe* recipe_p = _recipes[i];
+	recipe_p -> Materialize();
+	recipeNos[ recipe_p ] = i;
+
+	CB_FrozenRecipe& recipe = recipes[i];
+	recipe.name = freeze( recipe_p -> _name );
+	recipe.serves = freeze( recipe_p -> _serves );
+	recipe.category1 = freeze( recipe_p -> _category1 );
+	recipe.category2 = freeze( recipe_p -> _category2 );
+	recipe.category3 = freeze( recipe_p -> _category3 );
+	recipe.category4 = freeze( recipe_p -> _category4 );
+	recipe.date = freeze( recipe_p -> _date );
+
+	recipe.firstIngredient = ingredients.size();
+	recipe.nIngredients = recipe_p -> _ingredients.size();
+	CB_Ingredient_pVector_t::const_iterator iIng =
+					recipe_p -> _ingredients.begin();
+	CB_Ingredient_pVector_t::const_iterator iIngEnd =
+					recipe_p -> _ingredients.end();
+	for ( ; iIng != iIngEnd ; iIng++ ) {
+	    CB_FrozenIngredient ingredient;
+	    ingredient.quantity = freeze( (*iIng) -> _quantity );
+	    ingredient.measurement = freeze( (*iIng) -> _measurement );
+	    ingredient.preparation = freeze( (*iIng) -> _preparation );
+	    ingredient.ingredient = freeze( (*iIng) -> _ingredient );
+	    ingredients.push_back( ingredient );
+	}
+
+	recipe.firstDirection = directions.size();
+	recipe.nDirections = recipe_p -> _directions.size();
+	vector< CB_String >::const_iterator iDir =
+					recipe_p -> _directions.begin();
+	vector< CB_String >::const_iterator iDirEnd =
+					recipe_p -> _directions.end();
+	for ( ; iDir != iDirEnd ; iDir++ ) {
+	    directions.push_back( freeze( *iDir ) );
+	}
+    }
+
+    //...The indices, in the order of the maps and sets of the book
+    std::vector< uint32_t > byName;
+    CB_RecipeMap_t::const_iterator iRec = _sortedByName.begin();
+    CB_RecipeMap_t::const_iterator iRecEnd = _sortedByName.end();
+    for ( ; iRec != iRecEnd ; iRec++ ) {
+	byName.push_back( recipeNos[ (*iRec).second ] );
+    }
+
+    auto freezeMap = [ & ]( const CB_RecipeMap_t& theMap ) {
+	std::vector< CB_FrozenEntry > entries;
+	CB_RecipeMap_t::const_iterator iRec = theMap.begin();
+	CB_RecipeMap_t::const_iterator iRecEnd = theMap.end();
+	for ( ; iRec != iRecEnd ; iRec++ ) {
+	    CB_FrozenEntry entry;
+	    entry.key = freeze( (*iRec).first );
+	    entry.recipe = recipeNos[ (*iRec).second ];
+	    entries.push_back( entry );
+	}
+	return entries;
+    };
+    std::vector< CB_FrozenEntry > byCategory = freezeMap( _sortedByCategory );
+    std::vector< CB_FrozenEntry > byIngredient =
+					freezeMap( _sortedByIngredient );
+
+    auto freezeSet = [ & ]( const CB_StringSet_t& theSet ) {
+	std::vector< CB_FrozenString > names;
+	CB_StringSet_t::const_iterator iStr = theSet.begin();
+	CB_StringSet_t::const_iterator iStrEnd = theSet.end();
+	for ( ; iStr != iStrEnd ; iStr++ ) {
+	    names.push_back( freeze( *iStr ) );
+	}
+	return names;
+    };
+    std::vector< CB_FrozenString > names[5] = {
+	freezeSet( _categoryNames ), freezeSet( _quantityNames ),
+	freezeSet( _measurementNames ), freezeSet( _preparationNames ),
+	freezeSet( _ingredientNames ) };
+
+    if ( isTooLarge ) {
+	fprintf( stderr, "%s: too many strings for a frozen book\n", fName );
+	return 0;
     }
+
+    //...Lay out the tables, each one aligned to 8 bytes
+    const void* tables_p[ CB_FROZEN_TABLES ] = {
+	strings.data(), recipes.data(), ingredients.data(),
+	directions.data(), byName.data(), byCategory.data(),
+	byIngredient.data(), names[0].data(), names[1].data(),
+	names[2].data(), names[3].data(), names[4].data() };
+    size_t counts[ CB_FROZEN_TABLES ] = {
+	strings.size(), recipes.size(), ingredients.size(),
+	directions.size(), byName.size(), byCategory.size(),
+	byIngredient.size(), names[0].size(), names[1].size(),
+	names[2].size(), names[3].size(), names[4].size() };
+
+    CB_FrozenHeader header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, CB_FROZEN_MAGIC, sizeof(header.magic) );
+    header.version = CB_FROZEN_VERSION;
+    header.byteOrder = CB_FROZEN_BYTE_ORDER;
+    header.nTables = CB_FROZEN_TABLES;
+
+    static const char padding[8] = { 0 };
+    uint64_t offset = sizeof(header);
+    uint32_t crc = 0;
+    size_t t;
+    for ( t = 0 ; t < CB_FROZEN_TABLES ; t++ ) {
+	size_t size = counts[t] * CB_FrozenBook::ElementSize( t );
+	header.tables[t].offset = offset;
+	header.tables[t].count = counts[t];
+	crc = CB_Stream::Checksum( tables_p[t], size, crc );
+	crc = CB_Stream::Checksum( padding, -size & 7, crc );
+	offset += size + (-size & 7);
+    }
+    header.dataChecksum = crc;
+    header.headerChecksum = CB_Stream::Checksum( &header,
+				    offsetof( CB_FrozenHeader, headerChecksum ) );
+
+    CB_Stream stream( fName, "sb" );
+    stream.PutData( &header, sizeof(header) );
+    for ( t = 0 ; t < CB_FROZEN_TABLES ; t++ ) {
+	size_t size = counts[t] * CB_FrozenBook::ElementSize( t );
+	stream.PutData( tables_p[t], size );
+	stream.PutData( padding, -size & 7 );
+    }
+
+    if ( !stream.Commit() ) {
+	fprintf( stderr, "%s: cannot write the frozen book\n", fName );
+	return 0;
+    }
+    return stream.Get_bytesWritten();
 }
 
 //PAGE
 // ************************************************************************
-void
-CB_Book::PrintSortedNames(
-    std::ostream& o
+std::string
+CB_Book::JournalName(
+    const char*	fName
 )
 // ************************************************************************
+//
+// The journal of a .cbd file is the .cbj file of the same name.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    o << _sortedByName.size() << " entries" << endl;
-
-    CB_RecipeMap_t::iterator iRec = _sortedByName.begin();
-    CB_RecipeMap_t::iterator iRecEnd = _sortedByName.end();
-
-    for ( ; iRec != iRecEnd ; iRec++ ) {
-	CB_Recipe* recipe_p = (*iRec).second;
-	o << recipe_p -> _name << endl;
+    std::string name = fName;
+    size_t n = name.size();
+    if ( n >= 4 && name.compare( n - 4, 4, ".cbd" ) == 0 ) {
+	name.resize( n - 4 );
     }
+    return name + ".cbj";
 }
 
 //PAGE
 // ************************************************************************
 void
-CB_Book::PrintSortedCategories(
-    std::ostream& o
+CB_Book::Journal(
+    size_t			type,
+    size_t			recipeNo,
+    const CB_Recipe_pVector_t&	recipes
 )
 // ************************************************************************
+//
+// Append records of a change to the journal, if the book keeps one: a
+// record for each recipe, numbered from recipeNo on (NULL to record
+// none, as for deleting). They are appended and synced all at once.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    o << _sortedByCategory.size() << " entries" << endl;
+    if ( !_isJournaling ) {
+	return;
+    }
 
-    CB_RecipeMap_t::iterator iRec = _sortedByCategory.begin();
-    CB_RecipeMap_t::iterator iRecEnd = _sortedByCategory.end();
+    struct stat st;
+    bool isNew = stat( _journalName.c_str(), &st ) != 0 || st.st_size == 0;
 
-    while ( iRec != iRecEnd ) {
-	CB_String key = (*iRec).first;
-	o << key << endl;
+    CB_Stream stream( _journalName.c_str(), "ab" );
+    stream.Set_isLiteral();
+    if ( isNew ) {
+	stream.PutJournalHeader( _fingerprint );
+    }
 
-	size_t n = _sortedByCategory.count( key );
-	size_t i;
-	for ( i = 0 ; i < n ; i++, iRec++ ) {
-	    CB_Recipe* recipe_p = (*iRec).second;
-	    o << "    " << recipe_p -> _name << endl;
+    CB_Recipe_pVector_t::const_iterator iRec = recipes.begin();
+    CB_Recipe_pVector_t::const_iterator iRecEnd = recipes.end();
+    for ( ; iRec != iRecEnd ; iRec++, recipeNo++ ) {
+	stream.BeginRecord();
+	stream << type;
+	stream << recipeNo;
+	if ( *iRec != NULL ) {
+	    stream << *(*iRec);
 	}
+	stream.EndRecord();
+    }
+
+    if ( !stream.Commit() ) {
+	fprintf( stderr, "%s: cannot write the journal\n",
+						    _journalName.c_str() );
     }
 }
 
 //PAGE
 // ************************************************************************
 void
-CB_Book::PrintSortedIngredients(
-    std::ostream& o
+CB_Book::ReplayJournal(
+    bool	isRepairing
 )
 // ************************************************************************
+//
+// Apply the records of the journal to the book just read. With
+// isRepairing, a journal of another version of the file is removed,
+// and a damaged tail cut off, so that new records can follow.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    o << _sortedByIngredient.size() << " entries" << endl;
-
-    CB_RecipeMap_t::iterator iRec = _sortedByIngredient.begin();
-    CB_RecipeMap_t::iterator iRecEnd = _sortedByIngredient.end();
+    CB_Stream stream( _journalName.c_str(), "rb" );
+    stream.Set_isLiteral();
+
+    uint32_t fingerprint;
+    if ( !stream.GetJournalHeader( fingerprint ) ||
+					fingerprint != _fingerprint ) {
+	fprintf( stderr, "%s: not a journal of %s, ignored\n",
+				_journalName.c_str(), _fileName.c_str() );
+	if ( isRepairing ) {
+	    unlink( _journalName.c_str() );
+	}
+	return;
+    }
 
-    while ( iRec != iRecEnd ) {
-	CB_String key = (*iRec).first;
-	o << key << endl;
+    size_t goodSize = stream.RecordEnd();
+    while ( stream.NextRecord() ) {
+	size_t type;
+	size_t recipeNo;
+	stream >> type;
+	stream >> recipeNo;
+
+	if ( type == JOURNAL_ADD ) {
+	    CB_Recipe* recipe_p = new CB_Recipe();
+	    stream >> *recipe_p;
+	    if ( !stream.Good() ) {
+		delete recipe_p;
+		break;
+	    }
+	    Add( recipe_p );
+	}
+	else if ( type == JOURNAL_DELETE &&
+		  recipeNo < _recipes.size() - _nDeleted ) {
+	    Delete( _recipes[ LiveSlot( recipeNo ) ] );
+	}
+	else if ( type == JOURNAL_MODIFY &&
+		  recipeNo < _recipes.size() - _nDeleted ) {
+	    CB_Recipe recipe;
+	    stream >> recipe;
+	    if ( !stream.Good() ) {
+		break;
+	    }
+	    Modify( _recipes[ LiveSlot( recipeNo ) ], recipe );
+	}
+	else {
+	    break;
+	}
+	goodSize = stream.RecordEnd();
+    }
 
-	size_t n = _sortedByIngredient.count( key );
-	size_t i;
-	for ( i = 0 ; i < n ; i++, iRec++ ) {
-	    CB_Recipe* recipe_p = (*iRec).second;
-	    o << "    " << recipe_p -> _name << endl;
+    //...The rest of an interrupted append, or damage
+    struct stat st;
+    if ( stat( _journalName.c_str(), &st ) == 0 &&
+				    (size_t) st.st_size > goodSize ) {
+	fprintf( stderr, "%s: damaged after %zu bytes, the rest is ignored\n",
+					    _journalName.c_str(), goodSize );
+	if ( isRepairing && truncate( _journalName.c_str(), goodSize ) != 0 ) {
+	    perror( _journalName.c_str() );
 	}
     }
+}
 
+//PAGE
+// ************************************************************************
+unsigned int
+CB_Book::NThreads() const
+// ************************************************************************
+{
+    if ( _nThreads != 0 ) {
+	return _nThreads;
+    }
+    return max( std::thread::hardware_concurrency(), 1u );
 }
 
 //PAGE
 // ************************************************************************
-void
-CB_Book::Import(
-    char*	fName
+bool
+CB_Book::ReadRecipeOffsets(
+    CB_Stream&			stream,
+    std::vector< size_t >&	offsets
 )
 // ************************************************************************
-/*
-
-Apparently the first 0x33800 = 0634000 = 210944 bytes are devoted
-to indeces. I can't decipher them.
-
-The following information is the data, separated into blocks of records
-
-Each record consists of bytes:
-    record number in the block	(unsigned char)
-    character count		(unsigned char)
-    ASCII data (character count of them)
-An empty record is not kept (i.e. no "0" counts)
-
-For each recipe, the information is as follows:
+//
+// The offsets of the recipes in the recipe index section, if the file
+// has one. Returns false, with no offsets, if it has none.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    offsets.clear();
+    if ( !stream.SelectSection( CB_Stream::SECTION_RECIPE_INDEX ) ) {
+	return false;
+    }
 
-Block 0
-    Record 0	Recipe name
-    Record 1	Serves: count
-    Record 2-5	Classification(s)
-    Record 6-9	quadruples of Quantity,Measure,Prepartion,Ingredient
-	   ...
-	   26-29 - " -
-    Record 30	Date. Probably entry date.
-Block 1
-    Record 0-3	quadruples
-	   ...
-	   32-35 - " -
-Block 2
-    All records	Description
+    //...Every recipe takes three integers
+    size_t nRecipe;
+    stream >> nRecipe;
+    if ( nRecipe > stream.Remaining() / (3 * stream.MinIntSize()) ) {
+	return false;
+    }
 
-There are some special cases discovered by trial and error.
-They are documented by the code;
+    offsets.resize( nRecipe );
+    size_t i;
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	size_t name;
+	stream >> offsets[i];
+	stream >> name;
+    }
 
-It appears that the "read()" function (in cygwin, at least),
-converts the combination CR/LF to LF, thus messing up
-the actual data 10 13.
+    if ( !stream.Good() ) {
+	offsets.clear();
+	return false;
+    }
+    return true;
+}
 
-*/
+//PAGE
+// ************************************************************************
+void
+CB_Book::CountReferences(
+    std::vector< uint32_t >&	refCounts,
+    bool			isCountingDirections
+)
+// ************************************************************************
+//
+// The number of references to each address of the string table
+// from the recipes of the book, and from their directions unless
+// those are written apart.
+//
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    // Open the file in binary mode, so that no weird translation happens
-    FILE* inFile = fopen(fName,"rb");
+    refCounts.assign( _stringTable.AddressSize(), 0 );
 
-    if ( inFile == NULL ) {
-	printf("Cannot open the input file %s\n",fName);
-    }
+    CB_Recipe_pVector_t::const_iterator iRec = _recipes.begin();
+    CB_Recipe_pVector_t::const_iterator iRecEnd = _recipes.end();
 
-    unsigned char	buf[N_BUF];
-    int n = fread(buf,1,N_BUF,inFile);
+    for ( ; iRec != iRecEnd ; iRec++ ) {
+	const CB_Recipe& recipe = *(*iRec);
+
+	refCounts[ recipe._name.Get_address() ]++;
+	refCounts[ recipe._serves.Get_address() ]++;
+	refCounts[ recipe._category1.Get_address() ]++;
+	refCounts[ recipe._category2.Get_address() ]++;
+	refCounts[ recipe._category3.Get_address() ]++;
+	refCounts[ recipe._category4.Get_address() ]++;
+	refCounts[ recipe._date.Get_address() ]++;
+
+	recipe.Materialize();
+	CB_Ingredient_pVector_t::const_iterator iIng =
+						recipe._ingredients.begin();
+	CB_Ingredient_pVector_t::const_iterator iIngEnd =
+						recipe._ingredients.end();
+
+	for ( ; iIng != iIngEnd ; iIng++ ) {
+	    refCounts[ (*iIng) -> _quantity.Get_address() ]++;
+	    refCounts[ (*iIng) -> _measurement.Get_address() ]++;
+	    refCounts[ (*iIng) -> _preparation.Get_address() ]++;
+	    refCounts[ (*iIng) -> _ingredient.Get_address() ]++;
+	}
 
-    //...Skip the indeces
-    unsigned char* record_p = buf + 0634000;
+	if ( !isCountingDirections ) {
+	    continue;
+	}
 
-    size_t nRecipe=0;
-    size_t nBlock=0;
-    size_t length;
+	vector< CB_String >::const_iterator iDir = recipe._directions.begin();
+	vector< CB_String >::const_iterator iDirEnd = recipe._directions.end();
 
-    vector< vector< CB_String > > recipe(3);
-    CB_String emptyField;
+	for ( ; iDir != iDirEnd ; iDir++ ) {
+	    refCounts[ (*iDir).Get_address() ]++;
+	}
+    }
+}
 
-    for( ; record_p < buf + n && (*record_p) ; record_p += length + 2 ) {
+//PAGE
+// ************************************************************************
+void
+CB_Book::CompactAddresses(
+    std::vector< CB_Address_t >&	addressMap,
+    bool				isCountingDirections
+)
+// ************************************************************************
+//
+// New, dense addresses for the strings of the recipes, in the order in
+// which the recipes are written and use them. Strings of no recipe,
+// or only of directions written apart, get CB_NO_ADDRESS.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    addressMap.assign( _stringTable.AddressSize(), CB_NO_ADDRESS );
+    CB_Address_t nextAddress = 0;
 
-	while( *record_p == 0x00 ) {
-	    record_p++;
-	    if ( record_p >= buf + n ) {
-		return;
-	    }
+    auto renumber = [ &addressMap, &nextAddress ]( const CB_String& s ) {
+	CB_Address_t& newAddress = addressMap[ s.Get_address() ];
+	if ( newAddress == CB_NO_ADDRESS ) {
+	    newAddress = nextAddress++;
 	}
+    };
 
-	while( *record_p == 0xff ) {
-	    record_p++;
-	    nBlock++;
-	    if(nBlock==3) {
-
-		vector< CB_String >& block0 = recipe[0];
-		vector< CB_String >& block1 = recipe[1];
-		vector< CB_String >& block2 = recipe[2];
-
-		//...Create a new recipe and enter it.
-		CB_Recipe* recipe_p = new CB_Recipe();
-
-		recipe_p -> _name      = block0[0];
-		recipe_p -> _serves    = block0[1];
-		recipe_p -> _category1 = block0[2];
-		recipe_p -> _category2 = block0[3];
-		recipe_p -> _category3 = block0[4];
-		recipe_p -> _category4 = block0[5];
-		if ( block0.size() >= 31 ) {
-		    recipe_p -> _date = block0[30];
-		}
-		recipe_p -> _directions = block2;
-
-		vector< CB_String >::iterator iBl;
-		vector< CB_String >::iterator iBlEnd;
+    CB_Recipe_pVector_t::const_iterator iRec = _recipes.begin();
+    CB_Recipe_pVector_t::const_iterator iRecEnd = _recipes.end();
 
-		//...The ingredient quadruples in block 0
-		iBl = block0.begin() + 6;
-		iBlEnd = block0.end();
-		if ( block0.size() >= 31 ) {
-		    iBlEnd = block0.begin() + 30;
-		}
-		if ( block0.size() <= 6 ) {
-		    iBl = iBlEnd;
-		}
-		for ( ; iBl != iBlEnd ; ) {
-		    CB_Ingredient* ingredient_p = NewIngredient( iBl, iBlEnd );
-		    if ( ingredient_p != NULL ) {
-			recipe_p -> _ingredients.push_back( ingredient_p );
-		    }
-		}
+    for ( ; iRec != iRecEnd ; iRec++ ) {
+	const CB_Recipe& recipe = *(*iRec);
+	recipe.Materialize();
+
+	renumber( recipe._name );
+	renumber( recipe._serves );
+	renumber( recipe._category1 );
+	renumber( recipe._category2 );
+	renumber( recipe._category3 );
+	renumber( recipe._category4 );
+	renumber( recipe._date );
+
+	CB_Ingredient_pVector_t::const_iterator iIng =
+						recipe._ingredients.begin();
+	CB_Ingredient_pVector_t::const_iterator iIngEnd =
+						recipe._ingredients.end();
+	for ( ; iIng != iIngEnd ; iIng++ ) {
+	    renumber( (*iIng) -> _quantity );
+	    renumber( (*iIng) -> _measurement );
+	    renumber( (*iIng) -> _preparation );
+	    renumber( (*iIng) -> _ingredient );
+	}
 
-		//...The ingredient quadruples in block 1
-		iBl = block1.begin();
-		iBlEnd = block1.end();
-		for ( ; iBl != iBlEnd ; ) {
-		    CB_Ingredient* ingredient_p = NewIngredient( iBl, iBlEnd );
-		    if ( ingredient_p != NULL ) {
-			recipe_p -> _ingredients.push_back( ingredient_p );
-		    }
-		}
+	if ( !isCountingDirections ) {
+	    continue;
+	}
 
-		//...Add the recipe (with indexing)
-		Add( recipe_p );
+	vector< CB_String >::const_iterator iDir = recipe._directions.begin();
+	vector< CB_String >::const_iterator iDirEnd = recipe._directions.end();
+	for ( ; iDir != iDirEnd ; iDir++ ) {
+	    renumber( *iDir );
+	}
+    }
+}
 
-		//...Clear blocks of records
-		block0.clear();
-		block1.clear();
-		block2.clear();
+//PAGE
+// ************************************************************************
+void
+CB_Book::TrainDictionary(
+    std::string&	dictionary
+)
+// ************************************************************************
+//
+// A preset dictionary for deflating the directions: the phrases of up to
+// CB_DICTIONARY_WORDS words that recur in the directions of the book,
+// by the bytes they could save, up to CB_DICTIONARY_SIZE bytes. The best
+// phrases come last, where deflate refers to them at the least cost.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::unordered_map< std::string, size_t > counts;
 
-		//...Advance to next recipe
-		nRecipe++;
-		nBlock=0;
+    CB_Recipe_pVector_t::const_iterator iRec = _recipes.begin();
+    CB_Recipe_pVector_t::const_iterator iRecEnd = _recipes.end();
 
-		if ( nRecipe == 4 ) {
-		    while( *record_p == 0x00 ) {
-			record_p++;
-		    }
+    for ( ; iRec != iRecEnd ; iRec++ ) {
+	const CB_Recipe& recipe = *(*iRec);
+	recipe.Materialize();
+
+	vector< CB_String >::const_iterator iDir = recipe._directions.begin();
+	vector< CB_String >::const_iterator iDirEnd = recipe._directions.end();
+
+	for ( ; iDir != iDirEnd ; iDir++ ) {
+	    const char* text_p = (*iDir).c_str();
+	    size_t n = (*iDir).size();
+
+	    //...Where the words end, with the blank after them
+	    std::vector< size_t > ends;
+	    size_t i;
+	    for ( i = 0 ; i < n ; i++ ) {
+		if ( text_p[i] == ' ' || i + 1 == n ) {
+		    ends.push_back( i + 1 );
 		}
+	    }
 
-		//...I don't know why: special case of some sort
-		if ( nRecipe == 250 ) record_p += 2;
-		if ( nRecipe == 265 ) record_p += 257;
-		if ( nRecipe == 435 ) record_p += 257;
-		if ( nRecipe == 526 ) record_p += 2;
-		if ( nRecipe == 563 ) record_p += 257;
-
-		//...All done
-		if ( nRecipe == 607 ) {
-		    return;
+	    size_t begin = 0;
+	    size_t iWord;
+	    for ( iWord = 0 ; iWord < ends.size() ; iWord++ ) {
+		size_t iLast;
+		for ( iLast = iWord ; iLast < ends.size() &&
+			    iLast < iWord + CB_DICTIONARY_WORDS ; iLast++ ) {
+		    counts[ std::string( text_p + begin,
+					 ends[ iLast ] - begin ) ]++;
 		}
+		begin = ends[ iWord ];
 	    }
 	}
+    }
 
-	size_t recordNo = *(record_p) - 1;
-	length = *(record_p+1);
-	CB_String field( (char*)(record_p + 2), length );
-
-	vector< CB_String >& block = recipe[ nBlock ];
-	while ( block.size() < recordNo ) {
-	    block.push_back( emptyField );
+    //...Phrases that recur, by the bytes saved
+    std::vector< std::pair< size_t, const std::string* > > phrases;
+    std::unordered_map< std::string, size_t >::const_iterator iCnt;
+    for ( iCnt = counts.begin() ; iCnt != counts.end() ; iCnt++ ) {
+	if ( (*iCnt).second > 1 && (*iCnt).first.size() > 2 ) {
+	    phrases.push_back( std::make_pair(
+		((*iCnt).second - 1) * (*iCnt).first.size(), &(*iCnt).first ) );
 	}
+    }
+    std::sort( phrases.begin(), phrases.end(),
+	[]( const std::pair< size_t, const std::string* >& a,
+	    const std::pair< size_t, const std::string* >& b ) {
+	    return a.first != b.first ? a.first > b.first :
+					*a.second < *b.second;
+	} );
+
+    //...The best ones not yet in it, then the best last
+    std::vector< const std::string* > chosen;
+    std::string text;
+    size_t i;
+    for ( i = 0 ; i < phrases.size() ; i++ ) {
+	const std::string& phrase = *phrases[i].second;
+	if ( text.size() + phrase.size() <= CB_DICTIONARY_SIZE &&
+				text.find( phrase ) == std::string::npos ) {
+	    chosen.push_back( &phrase );
+	    text += phrase;
+	}
+    }
 
-	block.push_back( field );
+    dictionary.clear();
+    std::vector< const std::string* >::const_reverse_iterator iPhr;
+    for ( iPhr = chosen.rbegin() ; iPhr != chosen.rend() ; iPhr++ ) {
+	dictionary += *(*iPhr);
     }
 }
 
 //PAGE
 // ************************************************************************
-CB_Ingredient*
-CB_Book::NewIngredient(
-    std::vector< CB_String >::iterator&	first,
-    std::vector< CB_String >::iterator&	last
+void
+CB_Book::WriteRecipes(
+    CB_Stream&			stream,
+    std::vector< size_t >&	offsets
+)
+// ************************************************************************
+//
+// The recipes, as CB_Stream << CB_Book writes them, keeping the offset
+// of each recipe in the section.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    stream << _recipes.size();
+
+    CB_Recipe_pVector_t::const_iterator iRec = _recipes.begin();
+    CB_Recipe_pVector_t::const_iterator iRecEnd = _recipes.end();
+
+    for ( ; iRec != iRecEnd ; iRec++ ) {
+	offsets.push_back( stream.Tell() );
+	stream << *(*iRec);
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::WriteRecipeIndex(
+    CB_Stream&				stream,
+    const std::vector< size_t >&	offsets
+)
+// ************************************************************************
+//
+// The recipe index section: the offset and name of each recipe, then
+// the recipe numbers in name order.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t i;
+    size_t nRecipe = _recipes.size();
+
+    stream << nRecipe;
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	stream << offsets[i];
+	stream << _recipes[i] -> _name;
+    }
+
+    std::vector< size_t > byName( nRecipe );
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	byName[i] = i;
+    }
+
+    LT_CB_String lt;
+    std::stable_sort( byName.begin(), byName.end(),
+	[ this, &lt ]( size_t a, size_t b ) {
+	    return lt( _recipes[a] -> _name, _recipes[b] -> _name );
+	} );
+
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	stream << byName[i];
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::WriteIndexes(
+    CB_Stream&				stream,
+    const std::vector< uint32_t >&	refCounts
+)
+// ************************************************************************
+//
+// The indices section: for each recipe map, its size and its
+// (key address, recipe number) pairs in map order; for each name set,
+// its size and addresses. Names that no recipe references any more
+// are not in the file, so they are left out of the sets.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    IndexIngredients();
+
+    std::unordered_map< const CB_Recipe*, size_t > recipeNumbers;
+    size_t i;
+    size_t nRecipe = _recipes.size();
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	recipeNumbers[ _recipes[i] ] = i;
+    }
+
+    const CB_RecipeMap_t* maps[] = {
+	&_sortedByName, &_sortedByCategory, &_sortedByIngredient };
+
+    for ( i = 0 ; i < 3 ; i++ ) {
+	stream << maps[i] -> size();
+
+	CB_RecipeMap_t::const_iterator iRec = maps[i] -> begin();
+	CB_RecipeMap_t::const_iterator iRecEnd = maps[i] -> end();
+	for ( ; iRec != iRecEnd ; iRec++ ) {
+	    stream << (*iRec).first;
+	    stream << recipeNumbers[ (*iRec).second ];
+	}
+    }
+
+    const CB_StringSet_t* sets[] = {
+	&_categoryNames, &_quantityNames, &_measurementNames,
+	&_preparationNames, &_ingredientNames };
+
+    for ( i = 0 ; i < 5 ; i++ ) {
+	std::vector< CB_Address_t > addresses;
+
+	CB_StringSet_t::const_iterator iStr = sets[i] -> begin();
+	CB_StringSet_t::const_iterator iStrEnd = sets[i] -> end();
+	for ( ; iStr != iStrEnd ; iStr++ ) {
+	    if ( refCounts[ (*iStr).Get_address() ] > 0 ) {
+		addresses.push_back( (*iStr).Get_address() );
+	    }
+	}
+
+	stream << addresses.size();
+	std::vector< CB_Address_t >::const_iterator iAdr = addresses.begin();
+	std::vector< CB_Address_t >::const_iterator iAdrEnd = addresses.end();
+	for ( ; iAdr != iAdrEnd ; iAdr++ ) {
+	    stream << CB_StringRef( *iAdr );
+	}
+    }
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Book::ReadIndexes(
+    CB_Stream&	stream
+)
+// ************************************************************************
+//
+// Read the indices section written by WriteIndexes(). The entries are
+// in order, so every insertion goes at the end of its map or set.
+// Returns false, with the indices left empty, if the section does not
+// fit the recipes.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_RecipeMap_t* maps[] = {
+	&_sortedByName, &_sortedByCategory, &_sortedByIngredient };
+    CB_StringSet_t* sets[] = {
+	&_categoryNames, &_quantityNames, &_measurementNames,
+	&_preparationNames, &_ingredientNames };
+
+    bool isValid = true;
+    size_t i;
+    size_t nRecipe = _recipes.size();
+
+    for ( i = 0 ; i < 3 && isValid ; i++ ) {
+	size_t n;
+	stream >> n;
+
+	size_t k;
+	for ( k = 0 ; k < n && isValid ; k++ ) {
+	    size_t address;
+	    size_t recipeNo;
+	    stream >> address;
+	    stream >> recipeNo;
+
+	    isValid = stream.Good() && _stringTable.Contains( address ) &&
+							recipeNo < nRecipe;
+	    if ( isValid ) {
+		CB_Recipe* recipe_p = _recipes[ recipeNo ];
+		recipe_p -> AddEntry( i,
+		    maps[i] -> emplace_hint( maps[i] -> end(),
+				    CB_StringRef( address ), recipe_p ) );
+	    }
+	}
+    }
+
+    for ( i = 0 ; i < 5 && isValid ; i++ ) {
+	size_t n;
+	stream >> n;
+
+	size_t k;
+	for ( k = 0 ; k < n && isValid ; k++ ) {
+	    size_t address;
+	    stream >> address;
+
+	    isValid = stream.Good() && _stringTable.Contains( address );
+	    if ( isValid ) {
+		sets[i] -> emplace_hint( sets[i] -> end(),
+				    CB_StringRef( address ) );
+	    }
+	}
+    }
+
+    if ( !isValid ) {
+	for ( i = 0 ; i < 3 ; i++ ) {
+	    maps[i] -> clear();
+	}
+	for ( i = 0 ; i < 5 ; i++ ) {
+	    sets[i] -> clear();
+	}
+    }
+    return isValid;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::WriteRecipeIds(
+    CB_Stream&	stream
+)
+// ************************************************************************
+//
+// The recipe ids section: the next id of the book, the number of
+// recipes and the id of each recipe, in the order of the recipes.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t nRecipe = _recipes.size();
+
+    stream.PutUint64( _nextId );
+    stream << nRecipe;
+
+    size_t i;
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	stream.PutUint64( _recipes[i] -> Get_id() );
+    }
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Book::ReadRecipeIds(
+    CB_Stream&	stream
+)
+// ************************************************************************
+//
+// Read the recipe ids section written by WriteRecipeIds(). Returns
+// false, with no ids, if the section does not fit the recipes or gives
+// two of them the same id.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t nRecipe = _recipes.size();
+
+    uint64_t nextId = stream.GetUint64();
+    size_t n;
+    stream >> n;
+    bool isValid = stream.Good() && n == nRecipe;
+
+    _byId.reserve( nRecipe );
+
+    size_t i;
+    for ( i = 0 ; i < nRecipe && isValid ; i++ ) {
+	uint64_t id = stream.GetUint64();
+	isValid = stream.Good() && id > 0 && id < nextId &&
+			_byId.emplace( id, _recipes[i] ).second;
+	_recipes[i] -> Links().id = id;
+    }
+
+    if ( !isValid ) {
+	_byId.clear();
+	return false;
+    }
+    _nextId = nextId;
+    return true;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::NumberRecipeIds()
+// ************************************************************************
+//
+// Give the recipes the ids 1 to n, in order.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t nRecipe = _recipes.size();
+
+    _byId.clear();
+    _byId.reserve( nRecipe );
+
+    size_t i;
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	_recipes[i] -> Links().id = i + 1;
+	_byId.emplace( i + 1, _recipes[i] );
+    }
+    _nextId = nRecipe + 1;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Book::MakeBackup(
+    const char*	fName,
+    size_t	nBackups
+)
+// ************************************************************************
+//
+// Make a backup of the file, and remove all but the nBackups newest
+// backups of it (keep all of them for 0). Returns false if no backup
+// could be made.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::string dirName;
+    std::string baseName = fName;
+    size_t slash = baseName.rfind( '/' );
+    if ( slash != std::string::npos ) {
+	dirName = baseName.substr( 0, slash + 1 );
+	baseName = baseName.substr( slash + 1 );
+    }
+    std::string prefix = "backup_" + baseName + ".";
+
+    int inFd = open( fName, O_RDONLY );
+    if ( inFd < 0 ) {
+	perror( fName );
+	return false;
+    }
+
+    //...The backups of the file, oldest first
+    std::vector< std::string > backupNames;
+    DIR* dir_p = opendir( dirName.empty() ? "." : dirName.c_str() );
+    struct dirent* entry_p;
+    while ( dir_p != NULL && (entry_p = readdir( dir_p )) != NULL ) {
+	std::string name = entry_p -> d_name;
+	if ( name.compare( 0, prefix.size(), prefix ) != 0 ) {
+	    continue;
+	}
+
+	//...Only names made below: yyyymmdd-hhmmss, maybe -nn
+	std::string suffix = name.substr( prefix.size() );
+	size_t k;
+	bool isStamp = suffix.size() == 15 || suffix.size() == 18;
+	for ( k = 0 ; k < suffix.size() && isStamp ; k++ ) {
+	    isStamp = (k == 8 || k == 15) ? suffix[k] == '-' :
+					    isdigit( (unsigned char) suffix[k] );
+	}
+	if ( isStamp ) {
+	    backupNames.push_back( name );
+	}
+    }
+    if ( dir_p != NULL ) {
+	closedir( dir_p );
+    }
+    std::sort( backupNames.begin(), backupNames.end() );
+
+    //...A new name after all of them: the time, and a count if needed
+    char stamp[ 32 ];
+    time_t now = time( NULL );
+    struct tm tm;
+    strftime( stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r( &now, &tm ) );
+
+    std::string backupName;
+    unsigned int n = 0;
+    if ( !backupNames.empty() &&
+	 backupNames.back().compare( prefix.size(), 15, stamp ) >= 0 ) {
+	const std::string& last = backupNames.back();
+	n = (last.size() > prefix.size() + 15) ?
+		    atoi( last.c_str() + prefix.size() + 16 ) + 1 : 1;
+    }
+
+    int outFd = -1;
+    for ( ; n < 100 ; n++ ) {
+	char count[ 8 ] = "";
+	if ( n > 0 ) {
+	    snprintf( count, sizeof(count), "-%02u", n );
+	}
+	backupName = prefix + stamp + count;
+	outFd = open( (dirName + backupName).c_str(),
+				    O_WRONLY | O_CREAT | O_EXCL, 0666 );
+	if ( outFd >= 0 || errno != EEXIST ) {
+	    break;
+	}
+    }
+    backupNames.push_back( backupName );
+    backupName = dirName + backupName;
+
+    if ( outFd < 0 ) {
+	perror( backupName.c_str() );
+	close( inFd );
+	return false;
+    }
+
+    cout << backupName << endl;
+
+    //...A clone, a hard link, or a copy by the kernel
+    bool isCopied = false;
+#ifdef FICLONE
+    isCopied = ioctl( outFd, FICLONE, inFd ) == 0;
+#endif
+    if ( !isCopied ) {
+	close( outFd );
+	unlink( backupName.c_str() );
+	isCopied = link( fName, backupName.c_str() ) == 0;
+	outFd = -1;
+    }
+    if ( !isCopied ) {
+	outFd = open( backupName.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666 );
+	isCopied = outFd >= 0 && CopyFileData( inFd, outFd );
+	if ( !isCopied ) {
+	    perror( backupName.c_str() );
+	    unlink( backupName.c_str() );
+	}
+    }
+
+    if ( outFd >= 0 ) {
+	close( outFd );
+    }
+    close( inFd );
+
+    if ( !isCopied || nBackups == 0 ) {
+	return isCopied;
+    }
+
+    //...Remove the oldest
+    size_t i;
+    for ( i = 0 ; i + nBackups < backupNames.size() ; i++ ) {
+	unlink( (dirName + backupNames[i]).c_str() );
+    }
+    return true;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Book::CopyFileData(
+    int		inFd,
+    int		outFd
+)
+// ************************************************************************
+//
+// Copy the rest of a file in the kernel: by copy_file_range() where it
+// works between the two files, else by sendfile().
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    bool isCopyRange = true;
+    for (;;) {
+	ssize_t n;
+	if ( isCopyRange ) {
+	    n = copy_file_range( inFd, NULL, outFd, NULL, 1 << 30, 0 );
+	    if ( n < 0 && (errno == ENOSYS || errno == EXDEV ||
+			   errno == EINVAL || errno == EOPNOTSUPP) ) {
+		isCopyRange = false;
+		continue;
+	    }
+	}
+	else {
+	    n = sendfile( outFd, inFd, NULL, 1 << 30 );
+	}
+
+	if ( n < 0 && errno == EINTR ) {
+	    continue;
+	}
+	if ( n <= 0 ) {
+	    return n == 0;
+	}
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::Clear()
+// ************************************************************************
+{
+    CB_StringTableScope scope( _stringTable );
+
+    CB_Recipe_pVector_t::iterator iRec = _recipes.begin();
+    CB_Recipe_pVector_t::iterator iRecEnd = _recipes.end();
+
+    for ( ; iRec != iRecEnd ; iRec++ ) {
+	delete (*iRec);
+    }
+
+    _recipes.clear();
+    _nDeleted = 0;
+    _liveCounts.clear();
+    _byId.clear();
+    _nextId = 1;
+    _source_p.reset();
+    _isIngredientIndexPending = false;
+    _isJournaling = false;
+
+    _sortedByName.clear();
+    _sortedByCategory.clear();
+    _sortedByIngredient.clear();
+
+    _categoryNames.clear();
+    _quantityNames.clear();
+    _measurementNames.clear();
+    _preparationNames.clear();
+    _ingredientNames.clear();
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::Add(
+    CB_Recipe*	recipe_p
+)
+// ************************************************************************
+{
+    AddMany( CB_Recipe_pVector_t( 1, recipe_p ) );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::AddMany(
+    const CB_Recipe_pVector_t&	recipes
+)
+// ************************************************************************
+//
+// Add the recipes, in order, and index them all in one pass.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_StringTableScope scope( _stringTable );
+
+    size_t first = _recipes.size();
+    _recipes.reserve( first + recipes.size() );
+    _liveCounts.reserve( first + recipes.size() );
+
+    CB_Recipe_pVector_t::const_iterator iRec = recipes.begin();
+    CB_Recipe_pVector_t::const_iterator iRecEnd = recipes.end();
+    for ( ; iRec != iRecEnd ; iRec++ ) {
+	CB_Recipe* recipe_p = *iRec;
+
+	//...Add it to the book, in a new slot: node i of the tree counts
+	//...it and the recipes in the i & -i - 1 slots before it
+	size_t i = _recipes.size() + 1;
+	CB_RecipeLinks& links = recipe_p -> Links();
+	links.slot = _recipes.size();
+	_liveCounts.push_back( 1 + LiveBefore( i - 1 ) - LiveBefore( i - (i & -i) ) );
+	_recipes.push_back( recipe_p );
+
+	links.id = _nextId++;
+	_byId[ links.id ] = recipe_p;
+    }
+
+    IndexMany( _recipes.begin() + first, _recipes.end() );
+
+    Journal( JOURNAL_ADD, first - _nDeleted, recipes );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::Delete(
+    CB_Recipe*	recipe_p
+)
+// ************************************************************************
+{
+    CB_StringTableScope scope( _stringTable );
+
+    //...Delete references to it from the indices
+    Unindex( recipe_p );
+
+    //...Delete it from the list of recipes, leaving its slot empty
+    size_t slot = recipe_p -> Links().slot;
+    assert ( slot < _recipes.size() && _recipes[ slot ] == recipe_p );
+    Journal( JOURNAL_DELETE, LiveBefore( slot ),
+				CB_Recipe_pVector_t( 1, (CB_Recipe*) NULL ) );
+    _recipes[ slot ] = NULL;
+    _nDeleted++;
+    CountLiveSlot( slot, -1 );
+    _byId.erase( recipe_p -> Get_id() );
+
+    if ( _nDeleted * 2 > _recipes.size() ) {
+	CompactRecipes();
+    }
+
+    delete recipe_p;
+}
+
+//PAGE
+// ************************************************************************
+CB_Recipe*
+CB_Book::FindRecipe(
+    uint64_t	id
+) const
+// ************************************************************************
+//
+// The recipe with the id, or NULL if there is none.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::unordered_map< uint64_t, CB_Recipe* >::const_iterator iRec =
+							_byId.find( id );
+    return iRec == _byId.end() ? NULL : (*iRec).second;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::Modify(
+    CB_Recipe*		recipe_p,
+    const CB_Recipe&	recipe
+)
+// ************************************************************************
+//
+// Replace the contents of a recipe of the book. The recipe given may be
+// the recipe itself, edited in place.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_StringTableScope scope( _stringTable );
+
+    //...Delete references to it from the indices
+    Unindex( recipe_p );
+
+    //...Back among the entries of its keys at its own slot
+    *recipe_p = recipe;
+    CB_Recipe_pVector_t modified( 1, recipe_p );
+    IndexMany( modified.begin(), modified.end() );
+
+    size_t slot = recipe_p -> Links().slot;
+    assert ( slot < _recipes.size() && _recipes[ slot ] == recipe_p );
+    Journal( JOURNAL_MODIFY, LiveBefore( slot ), modified );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::Print(
+    std::ostream& o
+)
+// ************************************************************************
+{
+    CB_StringTableScope scope( _stringTable );
+    CompactRecipes();
+
+    size_t i;
+    size_t nRecipe = _recipes.size();
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	o << endl;
+	_recipes[i] -> Print(o);
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::PrintSortedNames(
+    std::ostream& o
+)
+// ************************************************************************
+{
+    CB_StringTableScope scope( _stringTable );
+
+    o << _sortedByName.size() << " entries" << endl;
+
+    CB_RecipeMap_t::iterator iRec = _sortedByName.begin();
+    CB_RecipeMap_t::iterator iRecEnd = _sortedByName.end();
+
+    for ( ; iRec != iRecEnd ; iRec++ ) {
+	CB_Recipe* recipe_p = (*iRec).second;
+	o << recipe_p -> _name << endl;
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::PrintSortedCategories(
+    std::ostream& o
+)
+// ************************************************************************
+{
+    CB_StringTableScope scope( _stringTable );
+
+    o << _sortedByCategory.size() << " entries" << endl;
+
+    CB_RecipeMap_t::iterator iRec = _sortedByCategory.begin();
+    CB_RecipeMap_t::iterator iRecEnd = _sortedByCategory.end();
+
+    while ( iRec != iRecEnd ) {
+	CB_StringRef key = (*iRec).first;
+	o << key << endl;
+
+	size_t n = _sortedByCategory.count( key );
+	size_t i;
+	for ( i = 0 ; i < n ; i++, iRec++ ) {
+	    CB_Recipe* recipe_p = (*iRec).second;
+	    o << "    " << recipe_p -> _name << endl;
+	}
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::PrintSortedIngredients(
+    std::ostream& o
+)
+// ************************************************************************
+{
+    CB_StringTableScope scope( _stringTable );
+    IndexIngredients();
+
+    o << _sortedByIngredient.size() << " entries" << endl;
+
+    CB_RecipeMap_t::iterator iRec = _sortedByIngredient.begin();
+    CB_RecipeMap_t::iterator iRecEnd = _sortedByIngredient.end();
+
+    while ( iRec != iRecEnd ) {
+	CB_StringRef key = (*iRec).first;
+	o << key << endl;
+
+	size_t n = _sortedByIngredient.count( key );
+	size_t i;
+	for ( i = 0 ; i < n ; i++, iRec++ ) {
+	    CB_Recipe* recipe_p = (*iRec).second;
+	    o << "    " << recipe_p -> _name << endl;
+	}
+    }
+
+}
+
+//PAGE
+// ************************************************************************
+size_t
+CB_Book::Import(
+    const char*	fName
+)
+// ************************************************************************
+/*
+
+Apparently the first 0x33800 = 0634000 = 210944 bytes are devoted
+to indeces. I can't decipher them.
+
+The following information is the data, separated into blocks of records
+
+Each record consists of bytes:
+    record number in the block	(unsigned char)
+    character count		(unsigned char)
+    ASCII data (character count of them)
+An empty record is not kept (i.e. no "0" counts)
+
+For each recipe, the information is as follows:
+
+Block 0
+    Record 0	Recipe name
+    Record 1	Serves: count
+    Record 2-5	Classification(s)
+    Record 6-9	quadruples of Quantity,Measure,Prepartion,Ingredient
+	   ...
+	   26-29 - " -
+    Record 30	Date. Probably entry date.
+Block 1
+    Record 0-3	quadruples
+	   ...
+	   32-35 - " -
+Block 2
+    All records	Description
+
+Each block ends with a 0xff byte. Recipes may be separated by runs of
+0x00 padding, and in places by a few bytes of something else (the old
+importer skipped 2 or 257 bytes after some recipes, found by trial and
+error). So a recipe is only taken where all three of its blocks check
+out (see ScanLegacyRecipe); elsewhere the importer moves on a byte at a
+time, and counts the bytes it skips for the report of the file.
+
+The file is mapped, so it can be of any size; the import ends with the
+file (see ScanLegacyFile). Returns the number of recipes imported.
+
+It appears that the "read()" function (in cygwin, at least),
+converts the combination CR/LF to LF, thus messing up
+the actual data 10 13.
+
+*/
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::vector< std::string > fileNames( 1, fName );
+    std::vector< CB_ImportReport > reports;
+    return ImportMany( fileNames, reports );
+}
+
+//PAGE
+// ************************************************************************
+size_t
+CB_Book::ImportMany(
+    const std::vector< std::string >&	fileNames,
+    std::vector< CB_ImportReport >&	reports
+)
+// ************************************************************************
+//
+// Import original cookbook files, as Import() does each one, in order.
+// Set_nThreads() threads map and scan the files for their recipes, the
+// costly part, while this thread adds the recipes of each file scanned
+// to the book in turn. So the book, and its one string table, are the
+// same as importing the files one by one makes. reports gets a report
+// for each file. Returns the number of recipes imported.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t nFiles = fileNames.size();
+    std::vector< CB_LegacyScan > scans( nFiles );
+    reports.assign( nFiles, CB_ImportReport() );
+
+    //...Each thread takes the next file not taken
+    std::atomic< size_t > nextFile( 0 );
+    std::vector< char > isScanned( nFiles, 0 );
+    std::mutex mutex;
+    std::condition_variable scanned;
+
+    auto scan = [ & ]() {
+	size_t i;
+	while ( (i = nextFile++) < nFiles ) {
+	    ScanLegacyFile( fileNames[i].c_str(), scans[i] );
+	    std::lock_guard< std::mutex > lock( mutex );
+	    isScanned[i] = 1;
+	    scanned.notify_all();
+	}
+    };
+
+    std::vector< std::thread > threads;
+    unsigned int nThreads = NThreads();
+    while ( nThreads > 1 && threads.size() < min( (size_t) nThreads, nFiles ) ) {
+	threads.push_back( std::thread( scan ) );
+    }
+
+    size_t i;
+    size_t nRecipe = 0;
+    for ( i = 0 ; i < nFiles ; i++ ) {
+	if ( threads.empty() ) {
+	    ScanLegacyFile( fileNames[i].c_str(), scans[i] );
+	}
+	else {
+	    std::unique_lock< std::mutex > lock( mutex );
+	    scanned.wait( lock, [ & ] { return isScanned[i] != 0; } );
+	}
+
+	std::chrono::steady_clock::time_point start =
+					std::chrono::steady_clock::now();
+	AddLegacyRecipes( scans[i] );
+	scans[i].report.addTime = std::chrono::duration< double >(
+			std::chrono::steady_clock::now() - start ).count();
+
+	reports[i] = scans[i].report;
+	nRecipe += reports[i].nRecipes;
+    }
+
+    for ( i = 0 ; i < threads.size() ; i++ ) {
+	threads[i].join();
+    }
+    return nRecipe;
+}
+
+//PAGE
+// ************************************************************************
+size_t
+CB_Book::ImportDirectory(
+    const char*				dirName,
+    std::vector< CB_ImportReport >&	reports
+)
+// ************************************************************************
+//
+// Import every file of a directory (see ImportMany), in name order.
+// Hidden files and subdirectories are left out. Returns the number of
+// recipes imported, 0 if the directory cannot be read.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    reports.clear();
+
+    DIR* dir_p = opendir( dirName );
+    if ( dir_p == NULL ) {
+	perror( dirName );
+	return 0;
+    }
+
+    std::vector< std::string > fileNames;
+    struct dirent* entry_p;
+    while ( (entry_p = readdir( dir_p )) != NULL ) {
+	if ( entry_p -> d_name[0] == '.' ) {
+	    continue;
+	}
+
+	std::string fileName = std::string( dirName ) + "/" + entry_p -> d_name;
+	struct stat st;
+	if ( stat( fileName.c_str(), &st ) == 0 && S_ISREG( st.st_mode ) ) {
+	    fileNames.push_back( fileName );
+	}
+    }
+    closedir( dir_p );
+    std::sort( fileNames.begin(), fileNames.end() );
+
+    return ImportMany( fileNames, reports );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::PrintImportReports(
+    std::ostream&				o,
+    const std::vector< CB_ImportReport >&	reports
+)
+// ************************************************************************
+{
+    size_t nRecipe = 0;
+    size_t nSkipped = 0;
+    double scanTime = 0;
+    double addTime = 0;
+
+    std::vector< CB_ImportReport >::const_iterator iRep = reports.begin();
+    std::vector< CB_ImportReport >::const_iterator iRepEnd = reports.end();
+
+    for ( ; iRep != iRepEnd ; iRep++ ) {
+	const CB_ImportReport& report = *iRep;
+	o << setw(7) << setiosflags(ios::right) << report.nRecipes <<
+	    " recipes" << setw(9) << report.nSkipped << " bytes skipped" <<
+	    setw(10) << setiosflags(ios::fixed) << setprecision(1) <<
+	    report.scanTime * 1000 << " ms scan" <<
+	    setw(10) << report.addTime * 1000 << " ms add  " <<
+	    resetiosflags(ios::right | ios::fixed) << report.fileName <<
+	    (report.isValid ? "" : " (not read)") << endl;
+
+	nRecipe += report.nRecipes;
+	nSkipped += report.nSkipped;
+	scanTime += report.scanTime;
+	addTime += report.addTime;
+    }
+
+    o << setw(7) << setiosflags(ios::right) << nRecipe <<
+	" recipes" << setw(9) << nSkipped << " bytes skipped" <<
+	setw(10) << setiosflags(ios::fixed) << setprecision(1) <<
+	scanTime * 1000 << " ms scan" <<
+	setw(10) << addTime * 1000 << " ms add  " <<
+	resetiosflags(ios::right | ios::fixed) << reports.size() <<
+	" files" << endl;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::ScanLegacyFile(
+    const char*		fName,
+    CB_LegacyScan&	scan
+)
+// ************************************************************************
+//
+// Map an original cookbook file and find its recipes: where each one
+// begins, and the bytes between them that are not in one. Only reads
+// the file, so files can be scanned on any thread.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::chrono::steady_clock::time_point start =
+					std::chrono::steady_clock::now();
+
+    CB_ImportReport& report = scan.report;
+    report.fileName = fName;
+
+    int fd = open( fName, O_RDONLY );
+    struct stat st;
+    if ( fd < 0 || fstat( fd, &st ) != 0 ) {
+	perror( fName );
+	if ( fd >= 0 ) {
+	    close( fd );
+	}
+	return;
+    }
+    if ( (size_t) st.st_size <= CB_LEGACY_DATA ) {
+	fprintf( stderr, "%s: not an original cookbook file\n", fName );
+	close( fd );
+	return;
+    }
+
+    void* map_p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( map_p == MAP_FAILED ) {
+	perror( fName );
+	return;
+    }
+    madvise( map_p, st.st_size, MADV_SEQUENTIAL );
+    scan.map_p = map_p;
+    scan.mapSize = st.st_size;
+    report.isValid = true;
+
+    //...Skip the indeces
+    const unsigned char* begin_p = (const unsigned char*) map_p;
+    const unsigned char* end_p = begin_p + st.st_size;
+    const unsigned char* record_p = begin_p + CB_LEGACY_DATA;
+    const unsigned char* skipped_p = NULL;
+
+    std::vector< std::string_view > blocks[3];
+
+    while ( (record_p = SkipLegacyPadding( record_p, end_p )) != end_p ||
+							skipped_p != NULL ) {
+	const unsigned char* next_p = record_p;
+	bool isRecipe = record_p != end_p &&
+			ScanLegacyRecipe( next_p, end_p, blocks );
+
+	if ( skipped_p == NULL && !isRecipe ) {
+	    skipped_p = record_p;
+	}
+	else if ( skipped_p != NULL && (isRecipe || record_p == end_p) ) {
+	    report.nSkipped += record_p - skipped_p;
+	    skipped_p = NULL;
+	}
+
+	if ( isRecipe ) {
+	    scan.offsets.push_back( record_p - begin_p );
+	    record_p = next_p;
+	}
+	else if ( record_p != end_p ) {
+	    record_p++;
+	}
+    }
+
+    report.scanTime = std::chrono::duration< double >(
+			std::chrono::steady_clock::now() - start ).count();
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::AddLegacyRecipes(
+    CB_LegacyScan&	scan
+)
+// ************************************************************************
+//
+// Add the recipes that ScanLegacyFile() found to the book, all at
+// once, and unmap the file.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    if ( scan.map_p == NULL ) {
+	return;
+    }
+
+    const unsigned char* begin_p = (const unsigned char*) scan.map_p;
+    const unsigned char* end_p = begin_p + scan.mapSize;
+    std::vector< std::string_view > blocks[3];
+
+    CB_StringTableScope scope( _stringTable );
+    CB_Recipe_pVector_t recipes;
+    recipes.reserve( scan.offsets.size() );
+
+    std::vector< size_t >::const_iterator iOff = scan.offsets.begin();
+    std::vector< size_t >::const_iterator iOffEnd = scan.offsets.end();
+    for ( ; iOff != iOffEnd ; iOff++ ) {
+	const unsigned char* record_p = begin_p + (*iOff);
+	ScanLegacyRecipe( record_p, end_p, blocks );
+	recipes.push_back( NewLegacyRecipe( blocks ) );
+	scan.report.nRecipes++;
+    }
+
+    //...Indexed together
+    AddMany( recipes );
+
+    munmap( scan.map_p, scan.mapSize );
+    scan.map_p = NULL;
+    scan.offsets.clear();
+}
+
+//PAGE
+// ************************************************************************
+const unsigned char*
+CB_Book::SkipLegacyPadding(
+    const unsigned char*	p,
+    const unsigned char*	end_p
+)
+// ************************************************************************
+//
+// Past a run of 0x00 padding, a word at a time while there is a word.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    while ( end_p - p >= (ptrdiff_t) sizeof(uint64_t) ) {
+	uint64_t word;
+	memcpy( &word, p, sizeof(word) );
+	if ( word != 0 ) {
+	    break;
+	}
+	p += sizeof(word);
+    }
+    while ( p != end_p && *p == 0x00 ) {
+	p++;
+    }
+    return p;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Book::ScanLegacyRecipe(
+    const unsigned char*&		p,
+    const unsigned char*		end_p,
+    std::vector< std::string_view >	blocks[3]
+)
+// ************************************************************************
+//
+// The three blocks of records of a recipe that begins at p, with an
+// empty field for each record not kept. Returns false if there is no
+// recipe at p: it does not begin with its name, a block does not end
+// with 0xff within the file, or a record of it is out of order, empty,
+// or not text (control characters other than tabs and line ends, or
+// 0xff). On success p is past the recipe.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    //...The highest record number of each block, plus 1
+    static const size_t maxRecordNo[3] = { 31, 36, 254 };
+
+    size_t b;
+    for ( b = 0 ; b < 3 ; b++ ) {
+	std::vector< std::string_view >& block = blocks[b];
+	block.clear();
+
+	if ( b == 0 && (p == end_p || *p == 0xff) ) {
+	    return false;
+	}
+
+	for ( ; ; ) {
+	    if ( p == end_p ) {
+		return false;
+	    }
+	    if ( *p == 0xff ) {
+		p++;
+		break;
+	    }
+
+	    size_t recordNo = *p;
+	    if ( recordNo <= block.size() || recordNo > maxRecordNo[b] ||
+		 (b == 0 && block.empty() && recordNo != 1) ||
+		 end_p - p < 2 ) {
+		return false;
+	    }
+	    size_t length = p[1];
+	    const unsigned char* text_p = p + 2;
+	    if ( length == 0 || (size_t) (end_p - text_p) < length ) {
+		return false;
+	    }
+
+	    //...Without branches, so that the compiler can vectorize it
+	    size_t i;
+	    size_t nBad = 0;
+	    for ( i = 0 ; i < length ; i++ ) {
+		unsigned char ch = text_p[i];
+		nBad += (ch < 0x20 && ch != '\t' && ch != '\n' && ch != '\r') |
+								(ch == 0xff);
+	    }
+	    if ( nBad != 0 ) {
+		return false;
+	    }
+
+	    block.resize( recordNo - 1 );
+	    block.push_back( std::string_view( (const char*) text_p, length ) );
+	    p = text_p + length;
+	}
+    }
+    return true;
+}
+
+//PAGE
+// ************************************************************************
+CB_Recipe*
+CB_Book::NewLegacyRecipe(
+    const std::vector< std::string_view >	blocks[3]
+)
+// ************************************************************************
+{
+    CB_StringTableScope scope( _stringTable );
+
+    vector< CB_String > block0;
+    vector< CB_String > block1;
+    vector< CB_String > block2;
+    vector< CB_String >* recipe[3] = { &block0, &block1, &block2 };
+
+    size_t b;
+    for ( b = 0 ; b < 3 ; b++ ) {
+	std::vector< std::string_view >::const_iterator iFld = blocks[b].begin();
+	std::vector< std::string_view >::const_iterator iFldEnd = blocks[b].end();
+	for ( ; iFld != iFldEnd ; iFld++ ) {
+	    recipe[b] -> push_back( CB_String( (*iFld).data(), (*iFld).size() ) );
+	}
+    }
+
+    //...Name, serves and categories even if they were not kept
+    while ( block0.size() < 6 ) {
+	block0.push_back( CB_String() );
+    }
+
+    //...Create a new recipe.
+    CB_Recipe* recipe_p = new CB_Recipe();
+
+    recipe_p -> _name      = block0[0];
+    recipe_p -> _serves    = block0[1];
+    recipe_p -> _category1 = block0[2];
+    recipe_p -> _category2 = block0[3];
+    recipe_p -> _category3 = block0[4];
+    recipe_p -> _category4 = block0[5];
+    if ( block0.size() >= 31 ) {
+	recipe_p -> _date = block0[30];
+    }
+    recipe_p -> _directions = block2;
+
+    vector< CB_String >::iterator iBl;
+    vector< CB_String >::iterator iBlEnd;
+
+    //...The ingredient quadruples in block 0
+    iBl = block0.begin() + 6;
+    iBlEnd = block0.end();
+    if ( block0.size() >= 31 ) {
+	iBlEnd = block0.begin() + 30;
+    }
+    for ( ; iBl != iBlEnd ; ) {
+	CB_Ingredient* ingredient_p = NewIngredient( iBl, iBlEnd );
+	if ( ingredient_p != NULL ) {
+	    recipe_p -> _ingredients.push_back( ingredient_p );
+	}
+    }
+
+    //...The ingredient quadruples in block 1
+    iBl = block1.begin();
+    iBlEnd = block1.end();
+    for ( ; iBl != iBlEnd ; ) {
+	CB_Ingredient* ingredient_p = NewIngredient( iBl, iBlEnd );
+	if ( ingredient_p != NULL ) {
+	    recipe_p -> _ingredients.push_back( ingredient_p );
+	}
+    }
+
+    return recipe_p;
+}
+
+//PAGE
+// ************************************************************************
+CB_Ingredient*
+CB_Book::NewIngredient(
+    std::vector< CB_String >::iterator&	first,
+    std::vector< CB_String >::iterator&	last
+)
+// ************************************************************************
+{
+    if ( first == last ) {
+	return NULL;
+    }
+
+    CB_String* s1_p = NULL;
+    CB_String* s2_p = NULL;
+    CB_String* s3_p = NULL;
+    CB_String* s4_p = NULL;
+
+    size_t totSize = 0;
+
+    // I have no idea what the heck I tried to do when I wrote this.
+    // Using pointers and iterators together is a mess.
+    // There was some change int the std, so that s1_p = first++
+    // no longer works. Thus, the contortions.
+    if ( first != last ) {
+	s1_p = &(*(first++));
+	totSize += s1_p -> size();
+    }
+    if ( first != last ) {
+	s2_p = &(*(first++));
+	totSize += s2_p -> size();
+    }
+    if ( first != last ) {
+	s3_p = &(*(first++));
+	totSize += s3_p -> size();
+    }
+    if ( first != last ) {
+	s4_p = &(*(first++));
+	totSize += s4_p -> size();
+    }
+
+    if ( totSize == 0 ) {
+	return NULL;
+    }
+
+    CB_StringTableScope scope( _stringTable );
+
+    CB_Ingredient* result = new CB_Ingredient();
+    if ( s1_p != NULL ) result -> _quantity = (*s1_p);
+    if ( s2_p != NULL ) result -> _measurement = (*s2_p);
+    if ( s3_p != NULL ) result -> _preparation = (*s3_p);
+    if ( s4_p != NULL ) result -> _ingredient = (*s4_p);
+
+    return result;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::TestDeletion()
+// ************************************************************************
+{
+    CB_StringTableScope scope( _stringTable );
+    CompactRecipes();
+
+    //...All but the last, first to last
+    CB_Recipe_pVector_t recipes = _recipes;
+    size_t i;
+    for ( i = 0 ; i + 1 < recipes.size() ; i++ ) {
+	Delete( recipes[i] ) ;
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::Index(
+    unsigned int	nThreads
+)
+// ************************************************************************
+//
+// Index all recipes. With more than one thread, the names, the
+// categories and the ingredients are indexed by three threads, each
+// in recipe order, so that the indices are the same as one thread
+// builds. The threads share the string table, which counts no
+// references while they run; the strings of the sets get theirs after,
+// and the recipes their entries.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_StringTableScope scope( _stringTable );
+
+    size_t i;
+    size_t nRecipe = _recipes.size();
+
+    if ( nThreads <= 1 ) {
+	IndexMany( _recipes.begin(), _recipes.end() );
+	return;
+    }
+
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	if ( !_recipes[i] -> IsMaterialized() ) {
+	    _isIngredientIndexPending = true;
+	}
+    }
+
+    std::vector< std::function< void( CB_Recipe* ) > > indexers;
+    indexers.push_back( [ this ]( CB_Recipe* recipe_p ) {
+	IndexName( recipe_p );
+    } );
+    indexers.push_back( [ this ]( CB_Recipe* recipe_p ) {
+	IndexCategories( recipe_p );
+    } );
+    indexers.push_back( [ this ]( CB_Recipe* recipe_p ) {
+	if ( recipe_p -> IsMaterialized() ) {
+	    IndexRecipeIngredients( recipe_p );
+	}
+    } );
+
+    bool isImmortal = _stringTable.Get_isImmortal();
+    _stringTable.Set_isImmortal();
+
+    std::vector< std::thread > threads;
+    std::vector< std::function< void( CB_Recipe* ) > >::const_iterator iIdx;
+    for ( iIdx = indexers.begin() ; iIdx != indexers.end() ; iIdx++ ) {
+	const std::function< void( CB_Recipe* ) >* indexer_p = &(*iIdx);
+	threads.push_back( std::thread( [ this, indexer_p ] {
+	    CB_StringTableScope scope( _stringTable );
+
+	    CB_Recipe_pVector_t::const_iterator iRec = _recipes.begin();
+	    CB_Recipe_pVector_t::const_iterator iRecEnd = _recipes.end();
+	    for ( ; iRec != iRecEnd ; iRec++ ) {
+		(*indexer_p)( *iRec );
+	    }
+	} ) );
+    }
+    for ( i = 0 ; i < threads.size() ; i++ ) {
+	threads[i].join();
+    }
+    for ( i = 0 ; i < 3 ; i++ ) {
+	LinkEntries( i );
+    }
+
+    _stringTable.Set_isImmortal( isImmortal );
+    if ( isImmortal ) {
+	return;
+    }
+
+    //...A reference for each string of a set, as inserting it makes
+    CB_StringSet_t* sets[] = {
+	&_categoryNames, &_quantityNames, &_measurementNames,
+	&_preparationNames, &_ingredientNames };
+
+    for ( i = 0 ; i < sizeof(sets) / sizeof(sets[0]) ; i++ ) {
+	CB_StringSet_t::const_iterator iStr = sets[i] -> begin();
+	CB_StringSet_t::const_iterator iStrEnd = sets[i] -> end();
+	for ( ; iStr != iStrEnd ; iStr++ ) {
+	    (*iStr).AddReference();
+	}
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::IndexMany(
+    CB_Recipe_pVector_t::const_iterator	first,
+    CB_Recipe_pVector_t::const_iterator	last
+)
+// ************************************************************************
+//
+// Index the recipes from first to last as IndexName(), IndexCategories()
+// and IndexRecipeIngredients() index each of them in turn, but with a
+// sort of the entries of each index and set and one ordered merge into
+// it, rather than a search of the tree for every entry.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_RecipeEntries_t names;
+    CB_RecipeEntries_t categories;
+    CB_RecipeEntries_t ingredients;
+
+    std::vector< CB_StringRef > categoryNames;
+    std::vector< CB_StringRef > quantityNames;
+    std::vector< CB_StringRef > measurementNames;
+    std::vector< CB_StringRef > preparationNames;
+    std::vector< CB_StringRef > ingredientNames;
+
+    names.reserve( last - first );
+
+    CB_Recipe_pVector_t::const_iterator iRec;
+    for ( iRec = first ; iRec != last ; iRec++ ) {
+	CB_Recipe* recipe_p = *iRec;
+
+	names.emplace_back( recipe_p -> _name, recipe_p );
+
+	const CB_String* cats[] = {
+	    &recipe_p -> _category1, &recipe_p -> _category2,
+	    &recipe_p -> _category3, &recipe_p -> _category4 };
+	size_t c;
+	for ( c = 0 ; c < 4 ; c++ ) {
+	    if ( cats[c] -> size() > 0 ) {
+		categoryNames.push_back( *cats[c] );
+		categories.emplace_back( *cats[c], recipe_p );
+	    }
+	}
+
+	//...Sorted by ingredient, once the ingredients are decoded
+	if ( !recipe_p -> IsMaterialized() ) {
+	    _isIngredientIndexPending = true;
+	    continue;
+	}
+
+	CB_Ingredient_pVector_t::const_iterator iIng = recipe_p ->
+						    _ingredients.begin();
+	CB_Ingredient_pVector_t::const_iterator iIngEnd = recipe_p ->
+						    _ingredients.end();
+	for ( ; iIng != iIngEnd ; iIng++ ) {
+	    const CB_String& qName = (*iIng) -> _quantity;
+	    const CB_String& mName = (*iIng) -> _measurement;
+	    const CB_String& pName = (*iIng) -> _preparation;
+	    const CB_String& iName = (*iIng) -> _ingredient;
+	    if ( qName.size() > 0 ) {
+		quantityNames.push_back( qName );
+	    }
+	    if ( mName.size() > 0 ) {
+		measurementNames.push_back( mName );
+	    }
+	    if ( pName.size() > 0 ) {
+		preparationNames.push_back( pName );
+	    }
+	    if ( iName.size() > 0 ) {
+		ingredientNames.push_back( iName );
+		ingredients.emplace_back( iName, recipe_p );
+	    }
+	}
+    }
+
+    MergeEntries( _sortedByName, names, INDEX_NAME );
+    MergeEntries( _sortedByCategory, categories, INDEX_CATEGORY );
+    MergeEntries( _sortedByIngredient, ingredients, INDEX_INGREDIENT );
+
+    MergeNames( _categoryNames, categoryNames );
+    MergeNames( _quantityNames, quantityNames );
+    MergeNames( _measurementNames, measurementNames );
+    MergeNames( _preparationNames, preparationNames );
+    MergeNames( _ingredientNames, ingredientNames );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::MergeEntries(
+    CB_RecipeMap_t&		map,
+    CB_RecipeEntries_t&		entries,
+    size_t			index
+)
+// ************************************************************************
+//
+// Sort the entries, keeping the order of those with the same key, and
+// insert them into the map among the entries it has of each key in the
+// order of the slots of their recipes, where indexing the whole book
+// puts them. Only the first entry of a key searches the map; the others
+// step back from the end of its entries only past those of later slots,
+// so the entries of recipes appended to the book go right at the end.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    LT_CB_String lt;
+    std::stable_sort( entries.begin(), entries.end(),
+	[ &lt ]( const CB_RecipeEntries_t::value_type& a,
+		 const CB_RecipeEntries_t::value_type& b ) {
+	    return lt( a.first, b.first );
+	} );
+
+    CB_RecipeMap_t::iterator iEnd = map.end();
+    size_t i;
+    for ( i = 0 ; i < entries.size() ; i++ ) {
+	if ( i == 0 || lt( entries[i - 1].first, entries[i].first ) ) {
+	    iEnd = map.upper_bound( entries[i].first );
+	}
+	CB_Recipe* recipe_p = entries[i].second;
+
+	//...After the entries of the key of recipes up to its own slot
+	CB_RecipeMap_t::iterator hint = iEnd;
+	while ( hint != map.begin() ) {
+	    CB_RecipeMap_t::iterator iPrev = std::prev( hint );
+	    if ( lt( (*iPrev).first, entries[i].first ) ||
+		 (*iPrev).second -> Links().slot <= recipe_p -> Links().slot ) {
+		break;
+	    }
+	    hint = iPrev;
+	}
+	recipe_p -> AddEntry( index,
+		map.emplace_hint( hint, entries[i].first, recipe_p ) );
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::MergeNames(
+    CB_StringSet_t&			set,
+    std::vector< CB_StringRef >&	names
+)
+// ************************************************************************
+//
+// Insert the names into the set, once each: the first of equal names
+// that the set does not have yet, as inserting them one by one does.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    LT_CB_String lt;
+    std::stable_sort( names.begin(), names.end(), lt );
+
+    size_t i;
+    for ( i = 0 ; i < names.size() ; i++ ) {
+	if ( i > 0 && !lt( names[i - 1], names[i] ) ) {
+	    continue;
+	}
+	CB_StringSet_t::iterator iStr = set.lower_bound( names[i] );
+	if ( iStr == set.end() || lt( names[i], *iStr ) ) {
+	    set.emplace_hint( iStr, names[i] );
+	}
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::IndexName(
+    CB_Recipe*	recipe_p
+)
+// ************************************************************************
+{
+    //...Sorted by name
+    _sortedByName.insert( CB_RecipeMap_t::value_type(
+			    recipe_p -> _name , recipe_p ) );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::IndexCategories(
+    CB_Recipe*	recipe_p
+)
+// ************************************************************************
+{
+    //...Sorted by category
+    if ( recipe_p -> _category1.size() > 0 ) {
+	_categoryNames.insert( recipe_p -> _category1 );
+	_sortedByCategory.insert( CB_RecipeMap_t::value_type(
+			    recipe_p -> _category1 , recipe_p ) );
+    }
+    if ( recipe_p -> _category2.size() > 0 ) {
+	_categoryNames.insert( recipe_p -> _category2 );
+	_sortedByCategory.insert( CB_RecipeMap_t::value_type(
+			    recipe_p -> _category2 , recipe_p ) );
+    }
+    if ( recipe_p -> _category3.size() > 0 ) {
+	_categoryNames.insert( recipe_p -> _category3 );
+	_sortedByCategory.insert( CB_RecipeMap_t::value_type(
+			    recipe_p -> _category3 , recipe_p ) );
+    }
+    if ( recipe_p -> _category4.size() > 0 ) {
+	_categoryNames.insert( recipe_p -> _category4 );
+	_sortedByCategory.insert( CB_RecipeMap_t::value_type(
+			    recipe_p -> _category4 , recipe_p ) );
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::IndexRecipeIngredients(
+    CB_Recipe*	recipe_p
+)
+// ************************************************************************
+{
+    CB_Ingredient_pVector_t::iterator iIng = recipe_p ->
+						    _ingredients.begin();
+    CB_Ingredient_pVector_t::iterator iIngEnd = recipe_p ->
+						    _ingredients.end();
+
+    for ( ; iIng != iIngEnd ; iIng++ ) {
+	const CB_String& qName = (*iIng) -> _quantity;
+	const CB_String& mName = (*iIng) -> _measurement;
+	const CB_String& pName = (*iIng) -> _preparation;
+	const CB_String& iName = (*iIng) -> _ingredient;
+	if ( qName.size() > 0 ) {
+	    _quantityNames.insert( qName );
+	}
+	if ( mName.size() > 0 ) {
+	    _measurementNames.insert( mName );
+	}
+	if ( pName.size() > 0 ) {
+	    _preparationNames.insert( pName );
+	}
+	if ( iName.size() > 0 ) {
+	    _ingredientNames.insert( iName );
+	    _sortedByIngredient.insert( CB_RecipeMap_t::value_type(
+				iName , recipe_p ) );
+	}
+	
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::IndexAllIngredients()
+// ************************************************************************
+//
+// Build the ingredient indices of a lazy book, decoding all recipes.
+// They are built from scratch: some recipes may have been decoded, and
+// some indexed, since the book was read.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_StringTableScope scope( _stringTable );
+    CompactRecipes();
+
+    _isIngredientIndexPending = false;
+
+    _sortedByIngredient.clear();
+    _quantityNames.clear();
+    _measurementNames.clear();
+    _preparationNames.clear();
+    _ingredientNames.clear();
+
+    size_t i;
+    size_t nRecipe = _recipes.size();
+
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	CB_Recipe* recipe_p = _recipes[i];
+	recipe_p -> Materialize();
+	IndexRecipeIngredients( recipe_p );
+    }
+    LinkEntries( INDEX_INGREDIENT );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::LinkEntries(
+    size_t	index
+)
+// ************************************************************************
+//
+// Give each recipe its entries in an index built without them, as by
+// IndexName(), IndexCategories() or IndexRecipeIngredients(), in place
+// of those it had.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_RecipeMap_t* maps[] = {
+	&_sortedByName, &_sortedByCategory, &_sortedByIngredient };
+
+    size_t i;
+    size_t nRecipe = _recipes.size();
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	if ( _recipes[i] == NULL ) {
+	    continue;
+	}
+	CB_RecipeLinks& links = _recipes[i] -> Links();
+	size_t first = 0;
+	size_t j;
+	for ( j = 0 ; j < index ; j++ ) {
+	    first += links.nEntries[j];
+	}
+	links.entries.erase( links.entries.begin() + first,
+		    links.entries.begin() + first + links.nEntries[ index ] );
+	links.nEntries[ index ] = 0;
+    }
+
+    CB_RecipeMap_t::iterator iEnt = maps[ index ] -> begin();
+    CB_RecipeMap_t::iterator iEntEnd = maps[ index ] -> end();
+    for ( ; iEnt != iEntEnd ; iEnt++ ) {
+	(*iEnt).second -> AddEntry( index, iEnt );
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::Unindex(
+    CB_Recipe*	recipe_p
+)
+// ************************************************************************
+//
+// Delete the entries of a recipe from the indices: only its own, which
+// it keeps.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_RecipeMap_t* maps[] = {
+	&_sortedByName, &_sortedByCategory, &_sortedByIngredient };
+
+    CB_RecipeLinks& links = recipe_p -> Links();
+    std::vector< CB_RecipeMap_t::iterator >::const_iterator iEnt =
+						    links.entries.begin();
+    size_t i;
+    for ( i = 0 ; i < 3 ; i++ ) {
+	size_t n;
+	for ( n = 0 ; n < links.nEntries[i] ; n++, iEnt++ ) {
+	    maps[i] -> erase( *iEnt );
+	}
+	links.nEntries[i] = 0;
+    }
+    links.entries.clear();
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::CompactRecipes()
+// ************************************************************************
+//
+// Drop the empty slots of deleted recipes, keeping the order of the
+// others, and number the slots again.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    if ( _nDeleted > 0 ) {
+	_recipes.erase( std::remove( _recipes.begin(), _recipes.end(),
+				    (CB_Recipe*) NULL ), _recipes.end() );
+	_nDeleted = 0;
+    }
+
+    //...Every slot live: node i of the tree counts i & -i of them
+    size_t i;
+    size_t nRecipe = _recipes.size();
+    _liveCounts.resize( nRecipe );
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	_recipes[i] -> Links().slot = i;
+	_liveCounts[i] = (i + 1) & -(i + 1);
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Book::CountLiveSlot(
+    size_t	slot,
+    int		delta
+)
+// ************************************************************************
+{
+    size_t i;
+    for ( i = slot + 1 ; i <= _liveCounts.size() ; i += i & -i ) {
+	_liveCounts[i - 1] += delta;
+    }
+}
+
+//PAGE
+// ************************************************************************
+size_t
+CB_Book::LiveBefore(
+    size_t	slot
+) const
+// ************************************************************************
+//
+// The number of recipes in the slots before slot: the recipe number of
+// the recipe in slot.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t n = 0;
+    size_t i;
+    for ( i = slot ; i > 0 ; i -= i & -i ) {
+	n += _liveCounts[i - 1];
+    }
+    return n;
+}
+
+//PAGE
+// ************************************************************************
+size_t
+CB_Book::LiveSlot(
+    size_t	recipeNo
+) const
+// ************************************************************************
+//
+// The slot of recipe number recipeNo, or the number of slots if there
+// is no such recipe.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t nSlot = _liveCounts.size();
+    size_t step = 1;
+    while ( step * 2 <= nSlot ) {
+	step *= 2;
+    }
+
+    //...The most slots with no more than recipeNo recipes in them
+    size_t slot = 0;
+    for ( ; step > 0 ; step /= 2 ) {
+	if ( slot + step <= nSlot && _liveCounts[slot + step - 1] <= recipeNo ) {
+	    slot += step;
+	    recipeNo -= _liveCounts[slot - 1];
+	}
+    }
+    return slot;
+}
+
+//PAGE
+// ************************************************************************
+CB_BookFile::~CB_BookFile()
+// ************************************************************************
+{
+    Close();
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_BookFile::Open(
+    const char*	fName
+)
+// ************************************************************************
+//
+// Index the string table and read the recipe index, with the names of
+// the recipes. Only those two sections are verified. A file without a
+// recipe index (version 1, say) gets one by a pass over its recipes.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_StringTableScope scope( _stringTable );
+
+    Close();
+
+    _stream_p.reset( new CB_Stream( fName, "rb" ) );
+    CB_Stream& stream = *_stream_p;
+    stream.Set_stringSource( &_stringSource );
+
+    bool isValid = stream.ReadHeader( false );
+
+    if ( isValid && stream.Get_version() == 1 ) {
+	isValid = IndexStrings( stream ) && ScanRecipes( stream );
+    }
+    else if ( isValid &&
+	      !stream.SelectSection( CB_Stream::SECTION_RECIPE_INDEX ) ) {
+	isValid = stream.VerifySection( CB_Stream::SECTION_STRINGS ) &&
+	    stream.VerifySection( CB_Stream::SECTION_RECIPES ) &&
+	    stream.SelectSection( CB_Stream::SECTION_STRINGS ) &&
+	    IndexStrings( stream ) &&
+	    stream.SelectSection( CB_Stream::SECTION_RECIPES ) &&
+	    ScanRecipes( stream );
+    }
+    else if ( isValid ) {
+	isValid = stream.VerifySection( CB_Stream::SECTION_STRINGS ) &&
+	    stream.VerifySection( CB_Stream::SECTION_RECIPE_INDEX ) &&
+	    stream.SelectSection( CB_Stream::SECTION_STRINGS ) &&
+	    IndexStrings( stream ) &&
+	    stream.SelectSection( CB_Stream::SECTION_RECIPE_INDEX );
+
+	//...The index: offsets and names, then the name order
+	size_t nRecipe = 0;
+	if ( isValid ) {
+	    stream >> nRecipe;
+
+	    //...Every recipe takes three integers
+	    isValid = nRecipe <= stream.Remaining() / (3 * stream.MinIntSize());
+	}
+	if ( isValid ) {
+	    _offsets.resize( nRecipe );
+	    _names.reserve( nRecipe );
+	    _byName.resize( nRecipe );
+
+	    size_t i;
+	    for ( i = 0 ; i < nRecipe && isValid ; i++ ) {
+		size_t name;
+		stream >> _offsets[i];
+		stream >> name;
+		isValid = AddName( name );
+	    }
+	    for ( i = 0 ; i < nRecipe && isValid ; i++ ) {
+		stream >> _byName[i];
+		isValid = _byName[i] < nRecipe;
+	    }
+	    isValid = isValid && stream.Good() &&
+		      stream.SelectSection( CB_Stream::SECTION_RECIPES );
+	}
+    }
+
+    if ( !isValid ) {
+	fprintf( stderr, "%s: not a valid cookbook file\n", fName );
+	Close();
+	return false;
+    }
+    return true;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_BookFile::IndexStrings(
+    CB_Stream&	stream
+)
+// ************************************************************************
+//
+// Note the address and offset of each string of the string table at
+// the current input, or the offset of its block if the table is front-
+// coded, without reading the strings into a table; and leave the input
+// after the table. GetString() reads them from their own input.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    _strings_p.reset( stream.NewSectionInput() );
+
+    size_t byStringSize;
+    size_t byAddressSize;
+    size_t freeAddressesSize;
+
+    stream >> byStringSize;
+    stream >> byAddressSize;
+    stream >> freeAddressesSize;
+
+    //...Every entry takes at least three integers, every free address one
+    size_t intSize = stream.MinIntSize();
+    if ( !stream.Good() || byStringSize > byAddressSize ||
+	 byAddressSize > CB_NO_ADDRESS ||
+	 byStringSize > stream.Remaining() / (3 * intSize) ||
+	 freeAddressesSize > stream.Remaining() / intSize ) {
+	return false;
+    }
+
+    bool isFrontCoded =
+		(stream.Get_encoding() & CB_Stream::ENCODING_FRONT_CODED) != 0;
+    _restart = 1;
+    if ( isFrontCoded ) {
+	size_t nBlocks;
+	stream >> _restart;
+	stream >> nBlocks;
+	if ( _restart == 0 ||
+	     nBlocks != (byStringSize + _restart - 1) / _restart ||
+	     !stream.Seek( stream.Tell() + nBlocks * sizeof(uint32_t) ) ) {
+	    return false;
+	}
+    }
+
+    _stringOffsets.reserve( byStringSize );
+
+    size_t i;
+    size_t offset = 0;
+    for ( i = 0 ; i < byStringSize && stream.Good() ; i++ ) {
+	if ( i % _restart == 0 ) {
+	    offset = stream.Tell();
+	}
+
+	size_t refCount;
+	size_t address;
+	size_t n;
+	stream >> refCount;
+	stream >> address;
+	if ( isFrontCoded ) {
+	    stream >> n;	//...The shared prefix
+	}
+	stream >> n;
+
+	if ( address >= byAddressSize || offset > UINT32_MAX ||
+	     !stream.Seek( stream.Tell() + n ) ) {
+	    return false;
+	}
+	_stringOffsets.push_back( std::make_pair( (CB_Address_t) address,
+						  (uint32_t) offset ) );
+    }
+
+    //...Past the free addresses
+    for ( i = 0 ; i < freeAddressesSize ; i++ ) {
+	size_t address;
+	stream >> address;
+    }
+
+    //...By address, each one once
+    std::sort( _stringOffsets.begin(), _stringOffsets.end() );
+    for ( i = 1 ; i < _stringOffsets.size() ; i++ ) {
+	if ( _stringOffsets[i - 1].first == _stringOffsets[i].first ) {
+	    return false;
+	}
+    }
+
+    _stringSource = [ this ]( size_t address, std::string_view& text ) {
+	return GetString( address, text );
+    };
+    return stream.Good();
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_BookFile::GetString(
+    size_t		address,
+    std::string_view&	text
+)
+// ************************************************************************
+//
+// The characters of the string at an address of the file: where they
+// lie in the file, or, if the table is front-coded, decoded from the
+// start of their block. Returns false if there is no such string.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::vector< std::pair< CB_Address_t, uint32_t > >::const_iterator
+	iStr = std::lower_bound( _stringOffsets.begin(), _stringOffsets.end(),
+			    std::make_pair( (CB_Address_t) address, (uint32_t) 0 ) );
+    if ( iStr == _stringOffsets.end() || (*iStr).first != address ) {
+	return false;
+    }
+
+    CB_Stream& stream = *_strings_p;
+    bool isFrontCoded =
+		(stream.Get_encoding() & CB_Stream::ENCODING_FRONT_CODED) != 0;
+    if ( !stream.Seek( (*iStr).second ) ) {
+	return false;
+    }
+
+    size_t i;
+    for ( i = 0 ; i < _restart ; i++ ) {
+	size_t refCount;
+	size_t stringAddress;
+	size_t shared = 0;
+	size_t n;
+	stream >> refCount;
+	stream >> stringAddress;
+	if ( isFrontCoded ) {
+	    stream >> shared;
+	}
+	stream >> n;
+
+	const char* p = stream.GetData( n );
+	if ( p == NULL || shared > _text.size() ||
+			  (shared != 0 && i == 0) ) {
+	    return false;
+	}
+
+	if ( !isFrontCoded ) {
+	    text = std::string_view( p, n );
+	    return stringAddress == address;
+	}
+
+	_text.resize( shared );
+	_text.append( p, n );
+	if ( stringAddress == address ) {
+	    text = _text;
+	    return true;
+	}
+    }
+    return false;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_BookFile::AddName(
+    size_t	address
+)
+// ************************************************************************
+//
+// Keep the name of the next recipe, at an address of the file, in the
+// table of the names. Returns false if there is no such string.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::string_view text;
+    if ( !GetString( address, text ) ) {
+	return false;
+    }
+
+    CB_StringTableScope scope( _nameTable );
+    _names.push_back( CB_String( text.data(), text.size() ).Get_address() );
+    return true;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_BookFile::ScanRecipes(
+    CB_Stream&	stream
+)
+// ************************************************************************
+//
+// Build the recipe index of a file that has none, from the recipes at
+// the current input, one recipe at a time.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t nRecipe;
+    stream >> nRecipe;
+
+    size_t i;
+    for ( i = 0 ; i < nRecipe && stream.Good() ; i++ ) {
+	_offsets.push_back( stream.Tell() );
+
+	//...Only the strings of one recipe at a time
+	if ( _stringTable.Size() == 0 ) {
+	    _stringTable.Clear();
+	}
+	CB_Recipe recipe;
+	stream >> recipe;
+	std::string_view name( recipe.Get_name().c_str(),
+			       recipe.Get_name().size() );
+
+	CB_StringTableScope scope( _nameTable );
+	_names.push_back( CB_String( name.data(), name.size() ).Get_address() );
+    }
+
+    //...Name order, as CB_Book::Get_sortedByName()
+    CB_StringTableScope scope( _nameTable );
+
+    _byName.resize( _offsets.size() );
+    for ( i = 0 ; i < _byName.size() ; i++ ) {
+	_byName[i] = i;
+    }
+
+    std::stable_sort( _byName.begin(), _byName.end(),
+	[ this ]( size_t a, size_t b ) {
+	    return strcmp( CB_StringRef( _names[a] ).c_str(),
+			   CB_StringRef( _names[b] ).c_str() ) < 0;
+	} );
+
+    return stream.Good();
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_BookFile::Close()
+// ************************************************************************
+{
+    _offsets.clear();
+    _names.clear();
+    _byName.clear();
+    _stringOffsets.clear();
+    _stringSource = NULL;
+    _strings_p.reset();
+    _stream_p.reset();
+
+    {
+	CB_StringTableScope scope( _nameTable );
+	_nameTable.Clear();
+	_nameTable.Set_isImmortal();
+    }
+
+    CB_StringTableScope scope( _stringTable );
+    _stringTable.Clear();
+}
+
+//PAGE
+// ************************************************************************
+CB_Recipe*
+CB_BookFile::GetRecipe(
+    size_t	n
+)
+// ************************************************************************
+//
+// Read recipe n (in file order). Returns NULL if there is no such
+// recipe, or if it cannot be read. When the caller keeps no strings of
+// the file, the string table starts over.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    if ( n >= _offsets.size() || !_stream_p -> Seek( _offsets[n] ) ) {
+	return NULL;
+    }
+
+    CB_StringTableScope scope( _stringTable );
+    if ( _stringTable.Size() == 0 ) {
+	_stringTable.Clear();
+    }
+
+    CB_Recipe* recipe_p = new CB_Recipe();
+    (*_stream_p) >> (*recipe_p);
+
+    if ( !_stream_p -> Good() ) {
+	delete recipe_p;
+	return NULL;
+    }
+    return recipe_p;
+}
+
+//PAGE
+// ************************************************************************
+CB_Recipe*
+CB_BookFile::FindRecipe(
+    const char*	name
+)
+// ************************************************************************
+//
+// Read the first recipe of this name, by a binary search of the index.
+// Returns NULL if there is none.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_StringTableScope scope( _nameTable );
+
+    std::vector< size_t >::const_iterator iRec = std::lower_bound(
+	_byName.begin(), _byName.end(), name,
+	[ this ]( size_t n, const char* name ) {
+	    return strcmp( CB_StringRef( _names[n] ).c_str(), name ) < 0;
+	} );
+
+    if ( iRec == _byName.end() ||
+	 strcmp( CB_StringRef( _names[*iRec] ).c_str(), name ) != 0 ) {
+	return NULL;
+    }
+    return GetRecipe( *iRec );
+}
+
+//PAGE
+// ************************************************************************
+CB_Address_t
+CB_BookFile::FindString(
+    const char*	s
+)
+// ************************************************************************
+//
+// The address of a string in the file, or CB_NO_ADDRESS if there is
+// none. A front-coded string table is searched where it is stored;
+// otherwise the strings of the file are read one by one.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    if ( _strings_p == NULL ) {
+	return CB_NO_ADDRESS;
+    }
+
+    size_t l = strlen( s );
+    std::string_view key( s, l );
+    std::string_view text;
+
+    if ( (_strings_p -> Get_encoding() & CB_Stream::ENCODING_FRONT_CODED) != 0 ) {
+	size_t address;
+	bool isFound = _strings_p -> FindString( s, l, address );
+	return (isFound && GetString( address, text )) ?
+					address : CB_NO_ADDRESS;
+    }
+
+    std::vector< std::pair< CB_Address_t, uint32_t > >::const_iterator
+						iStr = _stringOffsets.begin();
+    for ( ; iStr != _stringOffsets.end() ; iStr++ ) {
+	if ( GetString( (*iStr).first, text ) && text == key ) {
+	    return (*iStr).first;
+	}
+    }
+    return CB_NO_ADDRESS;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_BookFile::ForEachRecipe(
+    const CB_RecipeCallback_t&	callback
+)
+// ************************************************************************
+//
+// Read the recipes one at a time, in name order, and pass each one to
+// callback. A recipe is deleted when callback returns, so only one is
+// in memory at a time. Returns false if a recipe cannot be read.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_StringTableScope scope( _stringTable );
+
+    std::vector< size_t >::const_iterator iRec = _byName.begin();
+    std::vector< size_t >::const_iterator iRecEnd = _byName.end();
+
+    for ( ; iRec != iRecEnd ; iRec++ ) {
+	CB_Recipe* recipe_p = GetRecipe( *iRec );
+	if ( recipe_p == NULL ) {
+	    return false;
+	}
+	callback( *recipe_p );
+	delete recipe_p;
+    }
+    return true;
+}
+
+//PAGE
+// ************************************************************************
+CB_FrozenBook::CB_FrozenBook() :
+    _map_p( NULL ), _mapSize( 0 )
+// ************************************************************************
+{
+    Close();
+}
+
+//PAGE
+// ************************************************************************
+CB_FrozenBook::~CB_FrozenBook()
+// ************************************************************************
+{
+    Close();
+}
+
+//PAGE
+// ************************************************************************
+size_t
+CB_FrozenBook::ElementSize(
+    size_t	table
+)
+// ************************************************************************
+{
+    static const size_t sizes[ CB_FROZEN_TABLES ] = {
+	sizeof(char), sizeof(CB_FrozenRecipe), sizeof(CB_FrozenIngredient),
+	sizeof(CB_FrozenString), sizeof(uint32_t), sizeof(CB_FrozenEntry),
+	sizeof(CB_FrozenEntry), sizeof(CB_FrozenString),
+	sizeof(CB_FrozenString), sizeof(CB_FrozenString),
+	sizeof(CB_FrozenString), sizeof(CB_FrozenString) };
+
+    return sizes[ table ];
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_FrozenBook::Open(
+    const char*	fName
+)
+// ************************************************************************
+//
+// Map the image. Only the header and the bounds of the tables are
+// checked; Verify() checks the data.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    Close();
+
+    int fd = open( fName, O_RDONLY );
+    struct stat st;
+    if ( fd < 0 || fstat( fd, &st ) != 0 ) {
+	perror( fName );
+	if ( fd >= 0 ) {
+	    close( fd );
+	}
+	return false;
+    }
+
+    if ( (size_t) st.st_size >= sizeof(CB_FrozenHeader) ) {
+	void* map_p = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	if ( map_p == MAP_FAILED ) {
+	    perror( fName );
+	    close( fd );
+	    return false;
+	}
+	_map_p = map_p;
+	_mapSize = st.st_size;
+    }
+    close( fd );
+
+    const CB_FrozenHeader* header_p = (const CB_FrozenHeader*) _map_p;
+    bool isValid = header_p != NULL &&
+	memcmp( header_p -> magic, CB_FROZEN_MAGIC,
+				    sizeof(header_p -> magic) ) == 0 &&
+	header_p -> version == CB_FROZEN_VERSION &&
+	header_p -> byteOrder == CB_FROZEN_BYTE_ORDER &&
+	header_p -> nTables == CB_FROZEN_TABLES &&
+	header_p -> headerChecksum == CB_Stream::Checksum( header_p,
+				offsetof( CB_FrozenHeader, headerChecksum ) );
+
+    //...Every table aligned, and within the image
+    size_t t;
+    for ( t = 0 ; t < CB_FROZEN_TABLES && isValid ; t++ ) {
+	const CB_FrozenTable& table = header_p -> tables[t];
+	isValid = table.offset % 8 == 0 &&
+		  table.offset >= sizeof(CB_FrozenHeader) &&
+		  table.offset <= _mapSize &&
+		  table.count <= (_mapSize - table.offset) / ElementSize( t );
+	if ( isValid ) {
+	    _tables_p[t] = (const char*) _map_p + table.offset;
+	    _counts[t] = table.count;
+	}
+    }
+
+    //...So that every string ends within the characters
+    size_t nChars = _counts[ TABLE_STRINGS ];
+    isValid = isValid && nChars > 0 &&
+				_tables_p[ TABLE_STRINGS ][ nChars - 1 ] == '\0';
+
+    if ( !isValid ) {
+	fprintf( stderr, "%s: not a valid frozen book\n", fName );
+	Close();
+	return false;
+    }
+    return true;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_FrozenBook::Close()
+// ************************************************************************
+{
+    if ( _map_p != NULL ) {
+	munmap( _map_p, _mapSize );
+    }
+    _map_p = NULL;
+    _mapSize = 0;
+
+    size_t t;
+    for ( t = 0 ; t < CB_FROZEN_TABLES ; t++ ) {
+	_tables_p[t] = NULL;
+	_counts[t] = 0;
+    }
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_FrozenBook::Verify() const
+// ************************************************************************
+//
+// Check the tables against the checksum written with them. This reads
+// all of the image.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    if ( _map_p == NULL ) {
+	return false;
+    }
+    const CB_FrozenHeader* header_p = (const CB_FrozenHeader*) _map_p;
+    return header_p -> dataChecksum == CB_Stream::Checksum(
+			    header_p + 1, _mapSize - sizeof(CB_FrozenHeader) );
+}
+
+//PAGE
+// ************************************************************************
+const char*
+CB_FrozenBook::String(
+    const CB_FrozenString&	s
+) const
+// ************************************************************************
+//
+// The characters of s, or "" if they are not within the image.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    const char* chars_p = _tables_p[ TABLE_STRINGS ];
+    size_t nChars = _counts[ TABLE_STRINGS ];
+
+    if ( s.offset >= nChars || s.length >= nChars - s.offset ||
+				chars_p[ s.offset + s.length ] != '\0' ) {
+	return "";
+    }
+    return chars_p + s.offset;
+}
+
+//PAGE
+// ************************************************************************
+const CB_FrozenRecipe*
+CB_FrozenBook::GetRecipe(
+    size_t	n
+) const
+// ************************************************************************
+{
+    if ( n >= _counts[ TABLE_RECIPES ] ) {
+	return NULL;
+    }
+    return (const CB_FrozenRecipe*) _tables_p[ TABLE_RECIPES ] + n;
+}
+
+//PAGE
+// ************************************************************************
+const char*
+CB_FrozenBook::RecipeName(
+    size_t	n
+) const
+// ************************************************************************
+{
+    const CB_FrozenRecipe* recipe_p = GetRecipe( n );
+    return recipe_p != NULL ? String( recipe_p -> name ) : "";
+}
+
+//PAGE
+// ************************************************************************
+const CB_FrozenRecipe*
+CB_FrozenBook::FindRecipe(
+    const char*	name
+) const
+// ************************************************************************
+//
+// The first recipe of this name, by a binary search of BY_NAME.
+// Returns NULL if there is none.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t n;
+    const uint32_t* byName_p = SortedByName( n );
+
+    const uint32_t* iRec = std::lower_bound( byName_p, byName_p + n, name,
+	[ this ]( uint32_t recipeNo, const char* name ) {
+	    return strcmp( RecipeName( recipeNo ), name ) < 0;
+	} );
+
+    if ( iRec == byName_p + n || strcmp( RecipeName( *iRec ), name ) != 0 ) {
+	return NULL;
+    }
+    return GetRecipe( *iRec );
+}
+
+//PAGE
+// ************************************************************************
+const CB_FrozenIngredient*
+CB_FrozenBook::GetIngredients(
+    const CB_FrozenRecipe&	recipe,
+    size_t&			n
+) const
+// ************************************************************************
+{
+    const CB_FrozenIngredient* ingredients_p =
+		(const CB_FrozenIngredient*) _tables_p[ TABLE_INGREDIENTS ];
+    size_t nIngredients = _counts[ TABLE_INGREDIENTS ];
+
+    n = recipe.nIngredients;
+    if ( recipe.firstIngredient > nIngredients ||
+			    n > nIngredients - recipe.firstIngredient ) {
+	n = 0;
+	return ingredients_p;
+    }
+    return ingredients_p + recipe.firstIngredient;
+}
+
+//PAGE
+// ************************************************************************
+const CB_FrozenString*
+CB_FrozenBook::GetDirections(
+    const CB_FrozenRecipe&	recipe,
+    size_t&			n
+) const
+// ************************************************************************
+{
+    const CB_FrozenString* directions_p =
+		(const CB_FrozenString*) _tables_p[ TABLE_DIRECTIONS ];
+    size_t nDirections = _counts[ TABLE_DIRECTIONS ];
+
+    n = recipe.nDirections;
+    if ( recipe.firstDirection > nDirections ||
+			    n > nDirections - recipe.firstDirection ) {
+	n = 0;
+	return directions_p;
+    }
+    return directions_p + recipe.firstDirection;
+}
+
+//PAGE
+// ************************************************************************
+const CB_FrozenEntry*
+CB_FrozenBook::FindEntries(
+    size_t	table,
+    const char*	key,
+    size_t&	n
+) const
+// ************************************************************************
+//
+// The entries of key in a sorted index, by a binary search: n of them,
+// 0 if there are none.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t nEntries;
+    const CB_FrozenEntry* entries_p = Table< CB_FrozenEntry >( table, nEntries );
+
+    const CB_FrozenEntry* first_p = std::lower_bound(
+	entries_p, entries_p + nEntries, key,
+	[ this ]( const CB_FrozenEntry& entry, const char* key ) {
+	    return strcmp( String( entry.key ), key ) < 0;
+	} );
+    const CB_FrozenEntry* last_p = std::upper_bound(
+	first_p, entries_p + nEntries, key,
+	[ this ]( const char* key, const CB_FrozenEntry& entry ) {
+	    return strcmp( key, String( entry.key ) ) < 0;
+	} );
+
+    n = last_p - first_p;
+    return first_p;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_FrozenBook::Print(
+    std::ostream& o
+) const
+// ************************************************************************
+//
+// As CB_Book::Print() prints the book frozen.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t i;
+    size_t nRecipe = Size();
+    for ( i = 0 ; i < nRecipe ; i++ ) {
+	o << endl;
+	PrintRecipe( o, *GetRecipe( i ) );
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_FrozenBook::PrintRecipe(
+    std::ostream&		o,
+    const CB_FrozenRecipe&	recipe
+) const
+// ************************************************************************
+//
+// As CB_Recipe::Print() prints the recipe frozen.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t i;
+    size_t n;
+
+    size_t delimLen = 40;
+    size_t nameLen = strlen( String( recipe.name ) );
+    size_t leftLen = 0;
+    if ( nameLen < delimLen ) {
+	leftLen = (delimLen - nameLen) / 2;
+    }
+
+    std::string delim( delimLen, '-' );
+    o << "          " << delim << endl;
+    o << "          " << std::string( leftLen, ' ' ) <<
+					String( recipe.name ) << endl;
+    o << "          " << delim << endl;
+
+    o << endl;
+
+    if ( *String( recipe.serves ) != '\0' ) {
+	o << "Serves " << String( recipe.serves ) << endl;
+    }
+
+    o << setw(10) << setiosflags(ios::left) << "Quantity";
+    o << setw(13) << setiosflags(ios::left) << "Measurement";
+    o << setw(22) << setiosflags(ios::left) << "Preparation";
+    o << setw(22) << setiosflags(ios::left) << "Ingredient";
+    o << endl;
+    o << endl;
+
+    const CB_FrozenIngredient* ingredients_p = GetIngredients( recipe, n );
+    for ( i = 0 ; i < n ; i++ ) {
+	const CB_FrozenIngredient& ingredient = ingredients_p[i];
+	o << setw(10) << setiosflags(ios::left) <<
+					String( ingredient.quantity );
+	o << setw(13) << setiosflags(ios::left) <<
+					String( ingredient.measurement );
+	o << setw(22) << setiosflags(ios::left) <<
+					String( ingredient.preparation );
+	o << setw(22) << setiosflags(ios::left) <<
+					String( ingredient.ingredient );
+	o << endl;
+    }
+
+    o << endl << "Directions:" << endl;
+    o << endl;
+
+    const CB_FrozenString* directions_p = GetDirections( recipe, n );
+    for ( i = 0 ; i < n ; i++ ) {
+	o << String( directions_p[i] ) << endl;
+    }
+
+    const char* categories[] = {
+	String( recipe.category1 ), String( recipe.category2 ),
+	String( recipe.category3 ), String( recipe.category4 ) };
+    bool hasCategory = false;
+    for ( i = 0 ; i < 4 ; i++ ) {
+	hasCategory = hasCategory || *categories[i] != '\0';
+    }
+    if ( hasCategory ) {
+	o << endl;
+	o << "Categories: ";
+	for ( i = 0 ; i < 4 ; i++ ) {
+	    if ( *categories[i] != '\0' ) o << categories[i] << "    ";
+	}
+	o << endl;
+    }
+
+    if ( *String( recipe.date ) != '\0' ) {
+	o << endl;
+	o << "Modified " << String( recipe.date ) << endl;
+    }
+
+    o << endl;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_FrozenBook::PrintSortedNames(
+    std::ostream& o
+) const
+// ************************************************************************
+{
+    size_t n;
+    const uint32_t* byName_p = SortedByName( n );
+
+    o << n << " entries" << endl;
+
+    size_t i;
+    for ( i = 0 ; i < n ; i++ ) {
+	o << RecipeName( byName_p[i] ) << endl;
+    }
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_FrozenBook::PrintSortedCategories(
+    std::ostream& o
+) const
+// ************************************************************************
+{
+    PrintEntries( o, TABLE_BY_CATEGORY );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_FrozenBook::PrintSortedIngredients(
+    std::ostream& o
+) const
+// ************************************************************************
+{
+    PrintEntries( o, TABLE_BY_INGREDIENT );
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_FrozenBook::PrintEntries(
+    std::ostream&	o,
+    size_t		table
+) const
+// ************************************************************************
+//
+// A sorted index, as CB_Book::PrintSortedCategories() prints one: each
+// key, then the names of its recipes.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t n;
+    const CB_FrozenEntry* entries_p = Table< CB_FrozenEntry >( table, n );
+
+    o << n << " entries" << endl;
+
+    size_t i;
+    for ( i = 0 ; i < n ; i++ ) {
+	const char* key = String( entries_p[i].key );
+	if ( i == 0 || strcmp( key, String( entries_p[i - 1].key ) ) != 0 ) {
+	    o << key << endl;
+	}
+	o << "    " << RecipeName( entries_p[i].recipe ) << endl;
+    }
+}
+
+//PAGE
+// ************************************************************************
+CB_Stream::CB_Stream(
+    const char*	fileName,
+    const char*	mode
 )
 // ************************************************************************
 {
-    if ( first == last ) {
-	return NULL;
+    _fd = -1;
+    _isNewFile = false;
+    _bytesWritten = 0;
+    _map_p = NULL;
+    _mapSize = 0;
+    _begin_p = NULL;
+    _fileEnd_p = NULL;
+    _sectionBegin_p = NULL;
+    _next_p = NULL;
+    _end_p = NULL;
+    _version = CB_FILE_VERSION;
+    _encoding = 0;
+    _recordEnd_p = NULL;
+    _recordOffset = 0;
+    _addressMap_p = NULL;
+    _stringSource_p = NULL;
+    _directionSource_p = this;
+    _dictionary_p = NULL;
+    _dictionarySize = 0;
+    _directionData_p = NULL;
+    _directionEncoding = 0;
+    _directionBlockNo = (size_t) -1;
+    _isLazy = false;
+    _isLiteral = false;
+    _isGood = true;
+
+    if ( mode[0] == 'r' ) {
+	OpenInput( fileName );
+	return;
     }
+    OpenOutput( fileName, mode );
+}
 
-    CB_String* s1_p = NULL;
-    CB_String* s2_p = NULL;
-    CB_String* s3_p = NULL;
-    CB_String* s4_p = NULL;
+//PAGE
+// ************************************************************************
+CB_Stream::CB_Stream(
+    const char*	begin_p,
+    size_t	size,
+    uint32_t	encoding
+)
+// ************************************************************************
+//
+// Input from memory, which must outlive the stream, in the encoding of
+// the section it is part of.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    _fd = -1;
+    _isNewFile = false;
+    _bytesWritten = 0;
+    _map_p = NULL;
+    _mapSize = 0;
+    _begin_p = begin_p;
+    _fileEnd_p = begin_p + size;
+    _sectionBegin_p = begin_p;
+    _next_p = begin_p;
+    _end_p = _fileEnd_p;
+    _version = CB_FILE_VERSION;
+    _encoding = encoding;
+    _recordEnd_p = NULL;
+    _recordOffset = 0;
+    _addressMap_p = NULL;
+    _stringSource_p = NULL;
+    _directionSource_p = NULL;
+    _dictionary_p = NULL;
+    _dictionarySize = 0;
+    _directionData_p = NULL;
+    _directionEncoding = 0;
+    _directionBlockNo = (size_t) -1;
+    _isLazy = false;
+    _isLiteral = false;
+    _isGood = true;
+}
 
-    size_t totSize = 0;
+//PAGE
+// ************************************************************************
+void
+CB_Stream::OpenInput(
+    const char*	fileName
+)
+// ************************************************************************
+{
+    //...Leave it to the reader to fail, with no input
+    int fd = open( fileName, O_RDONLY );
+    struct stat st;
+    if ( fd < 0 || fstat( fd, &st ) != 0 ) {
+	perror( fileName );
+	if ( fd >= 0 ) {
+	    close( fd );
+	}
+	_isGood = false;
+	return;
+    }
 
-    // I have no idea what the heck I tried to do when I wrote this.
-    // Using pointers and iterators together is a mess.
-    // There was some change int the std, so that s1_p = first++
-    // no longer works. Thus, the contortions.
-    if ( first != last ) {
-	s1_p = &(*(first++));
-	totSize += s1_p -> size();
+    //...Map the file
+    if ( st.st_size > 0 ) {
+	void* map_p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if ( map_p != MAP_FAILED ) {
+	    madvise( map_p, st.st_size, MADV_SEQUENTIAL );
+	    _map_p = map_p;
+	    _mapSize = st.st_size;
+	    _begin_p = _sectionBegin_p = _next_p = (const char*) map_p;
+	    _fileEnd_p = _end_p = _next_p + _mapSize;
+	    close( fd );
+	    return;
+	}
     }
-    if ( first != last ) {
-	s2_p = &(*(first++));
-	totSize += s2_p -> size();
+
+    //...Or read all of it, if it cannot be mapped
+    char buf[ 65536 ];
+    ssize_t n;
+    while ( (n = read( fd, buf, sizeof(buf) )) != 0 ) {
+	if ( n < 0 ) {
+	    if ( errno == EINTR ) {
+		continue;
+	    }
+	    perror(fileName);
+	    _isGood = false;
+	    break;
+	}
+	_buffer.insert( _buffer.end(), buf, buf + n );
     }
-    if ( first != last ) {
-	s3_p = &(*(first++));
-	totSize += s3_p -> size();
+    close( fd );
+
+    _begin_p = _sectionBegin_p = _next_p = _buffer.data();
+    _fileEnd_p = _end_p = _next_p + _buffer.size();
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Stream::OpenOutput(
+    const char*	fileName,
+    const char*	mode
+)
+// ************************************************************************
+{
+    static std::atomic< unsigned int > nTemp( 0 );
+
+    _fileName = fileName;
+
+    if ( mode[0] == 's' ) {
+	//...A new file next to it, with its permissions
+	char suffix[ 64 ];
+	snprintf( suffix, sizeof(suffix), ".tmp%d.%u", (int) getpid(),
+							nTemp++ );
+	_tempName = _fileName + suffix;
+
+	_fd = open( _tempName.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666 );
+	struct stat st;
+	if ( _fd >= 0 && stat( fileName, &st ) == 0 ) {
+	    fchmod( _fd, st.st_mode & 07777 );
+	}
     }
-    if ( first != last ) {
-	s4_p = &(*(first++));
-	totSize += s4_p -> size();
+    else if ( mode[0] == 'a' ) {
+	//...Whether it is created, for Commit() to sync the directory
+	_fd = open( fileName, O_WRONLY | O_APPEND | O_CREAT | O_EXCL, 0666 );
+	_isNewFile = _fd >= 0;
+	if ( _fd < 0 && errno == EEXIST ) {
+	    _fd = open( fileName, O_WRONLY | O_APPEND );
+	}
+    }
+    else {
+	_fd = open( fileName, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
     }
 
-    if ( totSize == 0 ) {
-	return NULL;
+    //...Leave it to Flush() or Commit() to fail
+    if ( _fd < 0 ) {
+	perror( _tempName.empty() ? fileName : _tempName.c_str() );
+	_tempName.clear();
+	_isGood = false;
+    }
+}
+
+//PAGE
+// ************************************************************************
+CB_Stream::~CB_Stream()
+// ************************************************************************
+{
+    if ( _fd >= 0 && !_tempName.empty() ) {
+	//...Not committed: leave the file alone
+	close( _fd );
+	unlink( _tempName.c_str() );
+    }
+    else if ( _fd >= 0 ) {
+	Flush();
+	close( _fd );
+    }
+    if ( _map_p != NULL ) {
+	munmap( _map_p, _mapSize );
+    }
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::Flush()
+// ************************************************************************
+{
+    if ( _fd < 0 ) {
+	_buffer.clear();
+	return false;
+    }
+
+    const char* p = _buffer.data();
+    size_t n = _buffer.size();
+
+    while ( n > 0 ) {
+	ssize_t written = write( _fd, p, n );
+	if ( written < 0 ) {
+	    if ( errno == EINTR ) {
+		continue;
+	    }
+	    perror( "CB_Stream::Flush" );
+	    _isGood = false;
+	    break;
+	}
+	p += written;
+	n -= written;
+	_bytesWritten += written;
+    }
+
+    _buffer.clear();
+    return _isGood;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::Commit()
+// ************************************************************************
+//
+// Write out the buffered output and sync it to the disk. For mode "sb",
+// then rename the temporary file over the file, and sync the directory
+// so that the rename lasts too; likewise for a file that mode "ab"
+// created, so that the file lasts.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    Flush();
+    if ( _isGood && fsync( _fd ) != 0 ) {
+	perror( _fileName.c_str() );
+	_isGood = false;
+    }
+    if ( _fd >= 0 ) {
+	close( _fd );
+	_fd = -1;
+    }
+
+    if ( _tempName.empty() ) {
+	if ( _isGood && _isNewFile ) {
+	    SyncDirectory();
+	}
+	return _isGood;
+    }
+
+    if ( _isGood && rename( _tempName.c_str(), _fileName.c_str() ) != 0 ) {
+	perror( _fileName.c_str() );
+	_isGood = false;
+    }
+    if ( !_isGood ) {
+	unlink( _tempName.c_str() );
+    }
+    _tempName.clear();
+
+    if ( _isGood ) {
+	SyncDirectory();
+    }
+    return _isGood;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Stream::SyncDirectory()
+// ************************************************************************
+//
+// Sync the directory of the output file, so that a file created in it,
+// or renamed into it, lasts.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t slash = _fileName.rfind( '/' );
+    std::string dirName = (slash == std::string::npos) ? std::string( "." ) :
+			  (slash == 0) ? std::string( "/" ) :
+			  _fileName.substr( 0, slash );
+    int dirFd = open( dirName.c_str(), O_RDONLY | O_DIRECTORY );
+    if ( dirFd >= 0 ) {
+	fsync( dirFd );
+	close( dirFd );
+    }
+}
+
+//PAGE
+// ************************************************************************
+uint32_t
+CB_Stream::Checksum(
+    const void*	p,
+    size_t	n,
+    uint32_t	crc
+)
+// ************************************************************************
+//
+// CRC-32 (the one of zip and PNG). Pass the previous result as crc
+// to continue a checksum.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    static const std::vector< uint32_t > table = [] {
+	std::vector< uint32_t > t( 256 );
+	uint32_t i;
+	for ( i = 0 ; i < 256 ; i++ ) {
+	    uint32_t v = i;
+	    int k;
+	    for ( k = 0 ; k < 8 ; k++ ) {
+		v = (v & 1) ? 0xedb88320U ^ (v >> 1) : (v >> 1);
+	    }
+	    t[ i ] = v;
+	}
+	return t;
+    }();
+
+    const unsigned char* c_p = (const unsigned char*) p;
+    const unsigned char* cEnd_p = c_p + n;
+
+    crc = ~crc;
+    for ( ; c_p != cEnd_p ; c_p++ ) {
+	crc = table[ (crc ^ *c_p) & 0xff ] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Stream::BeginContainer()
+// ************************************************************************
+{
+    //...Room for the header, which is filled in by EndContainer()
+    _buffer.resize( _buffer.size() + sizeof(CB_FileHeader) );
+    _sections.clear();
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Stream::BeginSection(
+    uint32_t	id,
+    uint32_t	encoding
+)
+// ************************************************************************
+{
+    CB_SectionEntry entry;
+    memset( &entry, 0, sizeof(entry) );
+    entry.id = id;
+    entry.encoding = encoding;
+    entry.offset = _buffer.size();
+    _sections.push_back( entry );
+
+    _encoding = encoding;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Stream::EndSection()
+// ************************************************************************
+{
+    CB_SectionEntry& entry = _sections.back();
+    entry.size = _buffer.size() - entry.offset;
+    entry.checksum = Checksum( _buffer.data() + entry.offset, entry.size );
+
+    _encoding = 0;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Stream::EndContainer()
+// ************************************************************************
+{
+    CB_FileHeader header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, CB_FILE_MAGIC, sizeof(header.magic) );
+    header.version = CB_FILE_VERSION;
+    header.nSections = _sections.size();
+    header.directoryOffset = _buffer.size();
+
+    //...The directory
+    size_t directorySize = _sections.size() * sizeof(CB_SectionEntry);
+    PutBytes( _sections.data(), directorySize );
+    header.directoryChecksum = Checksum( _sections.data(), directorySize );
+
+    //...The header, at the start
+    header.headerChecksum = Checksum( &header,
+				offsetof( CB_FileHeader, headerChecksum ) );
+    memcpy( _buffer.data(), &header, sizeof(header) );
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::ReadHeader(
+    bool		isVerifyingSections,
+    unsigned int	nThreads
+)
+// ************************************************************************
+//
+// Check the container of the input. A file without the version 2 magic
+// is taken to be a version 1 file, and all of it is the current input.
+// Returns false, and clears Good(), if the file is corrupt. Without
+// isVerifyingSections, the sections are left to VerifySection(); with
+// it, up to nThreads threads check their checksums.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    size_t fileSize = _fileEnd_p - _begin_p;
+    _sections.clear();
+
+    CB_FileHeader header;
+    if ( fileSize < sizeof(header) ||
+		memcmp( _begin_p, CB_FILE_MAGIC, sizeof(header.magic) ) != 0 ) {
+	_version = 1;
+	return _isGood;
+    }
+    memcpy( &header, _begin_p, sizeof(header) );
+
+    //...Header and directory
+    if ( header.headerChecksum != Checksum( &header,
+			    offsetof( CB_FileHeader, headerChecksum ) ) ||
+	 header.version != CB_FILE_VERSION ||
+	 header.directoryOffset > fileSize ||
+	 header.nSections > (fileSize - header.directoryOffset) /
+						    sizeof(CB_SectionEntry) ) {
+	_isGood = false;
+	return false;
+    }
+    _version = header.version;
+
+    _sections.resize( header.nSections );
+    size_t directorySize = header.nSections * sizeof(CB_SectionEntry);
+    memcpy( _sections.data(), _begin_p + header.directoryOffset, directorySize );
+    if ( header.directoryChecksum != Checksum( _sections.data(),
+							directorySize ) ) {
+	_isGood = false;
+	return false;
+    }
+
+    std::vector< CB_SectionEntry >::const_iterator iSec = _sections.begin();
+    std::vector< CB_SectionEntry >::const_iterator iSecEnd = _sections.end();
+    for ( ; iSec != iSecEnd ; iSec++ ) {
+	if ( (*iSec).offset > fileSize ||
+			(*iSec).size > fileSize - (*iSec).offset ) {
+	    _isGood = false;
+	    return false;
+	}
+    }
+
+    if ( !isVerifyingSections ) {
+	return _isGood;
+    }
+
+    //...Section checksums: section k by thread k % nThreads
+    size_t nSections = _sections.size();
+    nThreads = max( (size_t) 1, min( (size_t) nThreads, nSections ) );
+    std::vector< char > isValid( nThreads, 1 );
+
+    auto verify = [ this, nSections, nThreads, &isValid ]( unsigned int t ) {
+	size_t k;
+	for ( k = t ; k < nSections && isValid[t] ; k += nThreads ) {
+	    const CB_SectionEntry& entry = _sections[k];
+	    isValid[t] = Checksum( _begin_p + entry.offset, entry.size ) ==
+							    entry.checksum;
+	}
+    };
+
+    std::vector< std::thread > threads;
+    unsigned int t;
+    for ( t = 1 ; t < nThreads ; t++ ) {
+	threads.push_back( std::thread( verify, t ) );
+    }
+    verify( 0 );
+    for ( t = 1 ; t < nThreads ; t++ ) {
+	threads[t - 1].join();
+    }
+    for ( t = 0 ; t < nThreads ; t++ ) {
+	if ( !isValid[t] ) {
+	    _isGood = false;
+	}
+    }
+
+    return _isGood;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::SelectSection(
+    uint32_t	id
+)
+// ************************************************************************
+//
+// Make the section the current input. Returns false if there is none,
+// or if it is in an encoding not known here.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::vector< CB_SectionEntry >::const_iterator iSec = _sections.begin();
+    std::vector< CB_SectionEntry >::const_iterator iSecEnd = _sections.end();
+
+    for ( ; iSec != iSecEnd ; iSec++ ) {
+	if ( (*iSec).id == id ) {
+	    if ( ((*iSec).encoding & ~ENCODING_ALL) != 0 ) {
+		return false;
+	    }
+	    _encoding = (*iSec).encoding;
+	    _sectionBegin_p = _next_p = _begin_p + (*iSec).offset;
+	    _end_p = _next_p + (*iSec).size;
+	    return true;
+	}
+    }
+    return false;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::VerifySection(
+    uint32_t	id
+)
+// ************************************************************************
+//
+// Check the checksum of a section. Returns false, and clears Good(),
+// if it does not match; and false if there is no such section.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::vector< CB_SectionEntry >::const_iterator iSec = _sections.begin();
+    std::vector< CB_SectionEntry >::const_iterator iSecEnd = _sections.end();
+
+    for ( ; iSec != iSecEnd ; iSec++ ) {
+	if ( (*iSec).id == id ) {
+	    if ( Checksum( _begin_p + (*iSec).offset, (*iSec).size ) !=
+							(*iSec).checksum ) {
+		_isGood = false;
+	    }
+	    return _isGood;
+	}
     }
+    return false;
+}
 
-    CB_Ingredient* result = new CB_Ingredient();
-    if ( s1_p != NULL ) result -> _quantity = (*s1_p);
-    if ( s2_p != NULL ) result -> _measurement = (*s2_p);
-    if ( s3_p != NULL ) result -> _preparation = (*s3_p);
-    if ( s4_p != NULL ) result -> _ingredient = (*s4_p);
-
-    return result;
+//PAGE
+// ************************************************************************
+CB_Stream*
+CB_Stream::NewSectionInput() const
+// ************************************************************************
+//
+// A new input over the current section, from its beginning, in its
+// encoding. It reads the mapping of this one, so it must not outlive
+// this one.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    return new CB_Stream( _sectionBegin_p, _end_p - _sectionBegin_p,
+							    _encoding );
 }
 
 //PAGE
 // ************************************************************************
-void
-CB_Book::TestDeletion()
+bool
+CB_Stream::Seek(
+    size_t	offset
+)
 // ************************************************************************
+//
+// Continue the input at an offset into the current section.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    while ( _recipes.size() > 1 ) {
-	CB_Recipe* recipe_p = _recipes[0];
-	Delete( recipe_p ) ;
+    if ( offset > (size_t) (_end_p - _sectionBegin_p) ) {
+	_isGood = false;
+	return false;
     }
+    _next_p = _sectionBegin_p + offset;
+    return true;
 }
 
 //PAGE
 // ************************************************************************
-void
-CB_Book::Index()
+size_t
+CB_Stream::Tell() const
 // ************************************************************************
+//
+// The offset into the current section: of the input, or of the output
+// since BeginSection().
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    size_t i;
-    size_t nRecipe = _recipes.size();
-
-    for ( i = 0 ; i < nRecipe ; i++ ) {
-	CB_Recipe* recipe_p = _recipes[i];
-	IndexRecipe( recipe_p );
+    if ( _begin_p != NULL ) {
+	return _next_p - _sectionBegin_p;
+    }
+    if ( _sections.empty() ) {
+	return _buffer.size();
     }
+    return _buffer.size() - _sections.back().offset;
 }
 
 //PAGE
 // ************************************************************************
 void
-CB_Book::IndexRecipe(
-    CB_Recipe*	recipe_p
+CB_Stream::PutJournalHeader(
+    uint32_t	fingerprint
 )
 // ************************************************************************
 {
-    //...Sorted by name
-    _sortedByName.insert( CB_RecipeMap_t::value_type(
-			    recipe_p -> _name , recipe_p ) );
-    
-    //...Sorted by category
-    if ( recipe_p -> _category1.size() > 0 ) {
-	_categoryNames.insert( recipe_p -> _category1 );
-	_sortedByCategory.insert( CB_RecipeMap_t::value_type(
-			    recipe_p -> _category1 , recipe_p ) );
-    }
-    if ( recipe_p -> _category2.size() > 0 ) {
-	_categoryNames.insert( recipe_p -> _category2 );
-	_sortedByCategory.insert( CB_RecipeMap_t::value_type(
-			    recipe_p -> _category2 , recipe_p ) );
-    }
-    if ( recipe_p -> _category3.size() > 0 ) {
-	_categoryNames.insert( recipe_p -> _category3 );
-	_sortedByCategory.insert( CB_RecipeMap_t::value_type(
-			    recipe_p -> _category3 , recipe_p ) );
-    }
-    if ( recipe_p -> _category4.size() > 0 ) {
-	_categoryNames.insert( recipe_p -> _category4 );
-	_sortedByCategory.insert( CB_RecipeMap_t::value_type(
-			    recipe_p -> _category4 , recipe_p ) );
-    }
-
-    //...Sorted by ingredient
-    CB_Ingredient_pVector_t::iterator iIng = recipe_p ->
-						    _ingredients.begin();
-    CB_Ingredient_pVector_t::iterator iIngEnd = recipe_p ->
-						    _ingredients.end();
+    PutBytes( CB_JOURNAL_MAGIC, 4 );
+    PutBytes( &fingerprint, sizeof(fingerprint) );
+}
 
-    for ( ; iIng != iIngEnd ; iIng++ ) {
-	CB_String qName = (*iIng) -> _quantity;
-	CB_String mName = (*iIng) -> _measurement;
-	CB_String pName = (*iIng) -> _preparation;
-	CB_String iName = (*iIng) -> _ingredient;
-	if ( qName.size() > 0 ) {
-	    _quantityNames.insert( qName );
-	}
-	if ( mName.size() > 0 ) {
-	    _measurementNames.insert( mName );
-	}
-	if ( pName.size() > 0 ) {
-	    _preparationNames.insert( pName );
-	}
-	if ( iName.size() > 0 ) {
-	    _ingredientNames.insert( iName );
-	    _sortedByIngredient.insert( CB_RecipeMap_t::value_type(
-				iName , recipe_p ) );
-	}
-	
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::GetJournalHeader(
+    uint32_t&	fingerprint
+)
+// ************************************************************************
+//
+// Read the header of a journal; NextRecord() then reads the records.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    const char* p = GetBytes( 4 + sizeof(fingerprint) );
+    if ( p == NULL || memcmp( p, CB_JOURNAL_MAGIC, 4 ) != 0 ) {
+	_isGood = false;
+	return false;
     }
+    memcpy( &fingerprint, p + 4, sizeof(fingerprint) );
+    _recordEnd_p = _next_p;
+    return true;
 }
 
 //PAGE
 // ************************************************************************
 void
-CB_Book::DeleteFromMap(
-    CB_Recipe*		recipe_p,
-    CB_RecipeMap_t&	theMap
-)
+CB_Stream::BeginRecord()
 // ************************************************************************
 {
-    //...Delete all references to the recipe from the map
-    CB_RecipeMap_t::iterator itorThis;
-    CB_RecipeMap_t::iterator itor = theMap.begin();
-    CB_RecipeMap_t::iterator itorEnd = theMap.end();
+    //...Room for the size and the checksum
+    _recordOffset = _buffer.size();
+    _buffer.resize( _buffer.size() + 2 * sizeof(uint32_t) );
+}
 
-    while ( itor != itorEnd ) {
-	itorThis = itor;
-	itor++;
-	if ( (*itorThis).second == recipe_p ) {
-	    theMap.erase( itorThis );
-	}
-    }
+//PAGE
+// ************************************************************************
+void
+CB_Stream::EndRecord()
+// ************************************************************************
+{
+    char* record_p = _buffer.data() + _recordOffset;
+    uint32_t size = _buffer.size() - _recordOffset - 2 * sizeof(uint32_t);
+    uint32_t checksum = Checksum( record_p + 2 * sizeof(uint32_t), size );
+
+    memcpy( record_p, &size, sizeof(uint32_t) );
+    memcpy( record_p + sizeof(uint32_t), &checksum, sizeof(uint32_t) );
 }
 
 //PAGE
 // ************************************************************************
-CB_Stream::CB_Stream(
-    const char*	fileName,
-    const char*	mode
-)
+bool
+CB_Stream::NextRecord()
 // ************************************************************************
+//
+// Make the next journal record the current input. Returns false at the
+// end of the journal, or at a record that is cut short or damaged.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    _file = fopen( fileName, mode );
-    if (!_file) {
-      perror(fileName);
-      exit(1);
+    const char* p = _recordEnd_p;
+    if ( p == NULL || (size_t) (_fileEnd_p - p) < 2 * sizeof(uint32_t) ) {
+	return false;
+    }
+
+    uint32_t size;
+    uint32_t checksum;
+    memcpy( &size, p, sizeof(uint32_t) );
+    memcpy( &checksum, p + sizeof(uint32_t), sizeof(uint32_t) );
+    p += 2 * sizeof(uint32_t);
+
+    if ( size > (size_t) (_fileEnd_p - p) || Checksum( p, size ) != checksum ) {
+	return false;
     }
+
+    _sectionBegin_p = _next_p = p;
+    _end_p = _recordEnd_p = p + size;
+    return true;
 }
 
 //PAGE
 // ************************************************************************
-CB_Stream::~CB_Stream()
+uint32_t
+CB_Stream::Fingerprint() const
 // ************************************************************************
+//
+// CRC-32 of all of the input, or of all of the output not yet flushed.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    fclose( _file );
+    if ( _begin_p != NULL ) {
+	return Checksum( _begin_p, _fileEnd_p - _begin_p );
+    }
+    return Checksum( _buffer.data(), _buffer.size() );
 }
 
 //PAGE
 // ************************************************************************
 CB_Stream&
 CB_Stream::operator << (
-    const CB_String	s
+    CB_StringRef	s
 )
 // ************************************************************************
 {
-    (*this) << (*(s._itor)).second.address;
+    if ( _isLiteral ) {
+	(*this) << s.size();
+	PutBytes( s.c_str(), s.size() );
+	return *this;
+    }
+
+    if ( _addressMap_p != NULL ) {
+	(*this) << (size_t) (*_addressMap_p)[ s._address ];
+	return *this;
+    }
+
+    (*this) << (size_t) s._address;
     return *this;
 }
 
@@ -906,37 +5149,167 @@ CB_Stream::operator << (
 )
 // ************************************************************************
 {
+    PutStringTable( table, NULL );
+    return *this;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Stream::PutStringTable(
+    const CB_StringTable&		table,
+    const std::vector< uint32_t >*	refCounts_p
+)
+// ************************************************************************
+//
+// Write the string table with the given reference count for each address,
+// or with the counts kept by the table if refCounts_p is NULL.
+// Strings without references are left out and their addresses freed.
+// With an address map, only the strings it maps are written, at their
+// new addresses and in that order, and there are no free addresses.
+//
+// With ENCODING_FRONT_CODED, the strings are always in sorted order,
+// in blocks of CB_STRING_RESTART. Each string but the first of a block
+// is the length of the prefix it shares with the one before it, and
+// the rest of its characters. The offsets of the blocks come before
+// them, so that FindString() can search the first strings.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::vector< CB_Address_t > sorted;
+    std::vector< CB_Address_t > freeAddresses;
+    size_t byAddressSize = table._byAddress.size();
+
+    if ( _addressMap_p != NULL ) {
+	//...The old address of each new one; the new ones are dense
+	const std::vector< CB_Address_t >& addressMap = *_addressMap_p;
+	CB_Address_t address;
+	for ( address = 0 ; address < addressMap.size() ; address++ ) {
+	    CB_Address_t newAddress = addressMap[ address ];
+	    if ( newAddress != CB_NO_ADDRESS ) {
+		if ( newAddress >= sorted.size() ) {
+		    sorted.resize( newAddress + 1 );
+		}
+		sorted[ newAddress ] = address;
+	    }
+	}
+	byAddressSize = sorted.size();
+    }
+    else {
+	sorted = table.SortedAddresses();
+	freeAddresses = table._freeAddresses;
+    }
+
+    if ( refCounts_p != NULL && _addressMap_p == NULL ) {
+	std::vector< CB_Address_t >::iterator iLive = sorted.begin();
+	std::vector< CB_Address_t >::iterator iStr = sorted.begin();
+	std::vector< CB_Address_t >::iterator iStrEnd = sorted.end();
+
+	for ( ; iStr != iStrEnd; iStr++ ) {
+	    if ( (*refCounts_p)[ *iStr ] > 0 ) {
+		*(iLive++) = *iStr;
+	    }
+	    else {
+		freeAddresses.push_back( *iStr );
+	    }
+	}
+	sorted.erase( iLive, sorted.end() );
+    }
+
+    bool isFrontCoded = (_encoding & ENCODING_FRONT_CODED) != 0;
+    const CB_StringData* data_p = table._byAddress.data();
+
+    if ( isFrontCoded && _addressMap_p != NULL ) {
+	stable_sort( sorted.begin(), sorted.end(),
+	    [ data_p ]( CB_Address_t a1, CB_Address_t a2 ) {
+		return strcmp( data_p[ a1 ].string_p,
+			       data_p[ a2 ].string_p ) < 0;
+	    } );
+    }
+
     //...Sizes
-    (*this) << table._byString.size();
-    (*this) << table._byAddress.size();
-    (*this) << table._freeAddresses.size();
+    (*this) << sorted.size();
+    (*this) << byAddressSize;
+    (*this) << freeAddresses.size();
+
+    //...Room for the block offsets
+    size_t offsetsBegin = 0;
+    size_t blocksBegin = 0;
+    if ( isFrontCoded ) {
+	size_t nBlocks = (sorted.size() + CB_STRING_RESTART - 1) /
+						    CB_STRING_RESTART;
+	(*this) << (size_t) CB_STRING_RESTART;
+	(*this) << nBlocks;
+
+	offsetsBegin = _buffer.size();
+	_buffer.resize( _buffer.size() + nBlocks * sizeof(uint32_t) );
+	blocksBegin = _buffer.size();
+    }
 
-    CB_StringTable_t::const_iterator iStr = table._byString.begin();
-    CB_StringTable_t::const_iterator iStrEnd = table._byString.end();
+    const CB_StringData* previous_p = NULL;
+    size_t i = 0;
+
+    std::vector< CB_Address_t >::const_iterator iStr = sorted.begin();
+    std::vector< CB_Address_t >::const_iterator iStrEnd = sorted.end();
 
     //...Strings
-    for ( ; iStr != iStrEnd; iStr++ ) {
+    for ( ; iStr != iStrEnd; iStr++, i++ ) {
+	const CB_StringData& data = table._byAddress[ *iStr ];
+
+	//...Offset of a new block
+	if ( isFrontCoded && i % CB_STRING_RESTART == 0 ) {
+	    uint32_t offset = _buffer.size() - blocksBegin;
+	    memcpy( _buffer.data() + offsetsBegin +
+			(i / CB_STRING_RESTART) * sizeof(uint32_t),
+		    &offset, sizeof(uint32_t) );
+	}
+
 	//...Reference count and address
-	(*this) << (*iStr).second.refCount;
-	(*this) << (*iStr).second.address;
+	if ( refCounts_p != NULL ) {
+	    (*this) << (size_t) (*refCounts_p)[ *iStr ];
+	}
+	else {
+	    (*this) << (size_t) data.refCount;
+	}
+	if ( _addressMap_p != NULL ) {
+	    (*this) << (size_t) (*_addressMap_p)[ *iStr ];
+	}
+	else {
+	    (*this) << (size_t) (*iStr);
+	}
+
+	const char* p = data.string_p;
+	size_t n = data.length;
+
+	if ( isFrontCoded ) {
+	    size_t shared = 0;
+	    if ( i % CB_STRING_RESTART != 0 ) {
+		size_t nShared = min( n, (size_t) previous_p -> length );
+		while ( shared < nShared &&
+			p[ shared ] == previous_p -> string_p[ shared ] ) {
+		    shared++;
+		}
+	    }
+	    previous_p = &data;
 
-	const char* p = (*iStr).first.data();
-	size_t n = (*iStr).first.size();
+	    //...Shared prefix, then the rest
+	    (*this) << shared;
+	    p += shared;
+	    n -= shared;
+	}
 
 	//...Char count and characters
 	(*this) << n;
-	fwrite( p, 1, n, _file );
+	PutBytes( p, n );
     }
 
     //...Free addresses
-    vector< size_t >::const_iterator itor = table._freeAddresses.begin();
-    vector< size_t >::const_iterator itorEnd = table._freeAddresses.end();
+    vector< CB_Address_t >::const_iterator itor = freeAddresses.begin();
+    vector< CB_Address_t >::const_iterator itorEnd = freeAddresses.end();
 
     for ( ; itor != itorEnd ; itor++ ) {
-	(*this) << (*itor);
+	(*this) << (size_t) (*itor);
     }
-
-    return *this;
 }
 
 //PAGE
@@ -963,6 +5336,8 @@ CB_Stream::operator << (
 )
 // ************************************************************************
 {
+    recipe.Materialize();
+
     //...Sizes
     (*this) << recipe._ingredients.size();
     (*this) << recipe._directions.size();
@@ -984,6 +5359,11 @@ CB_Stream::operator << (
 	(*this) << *(*iIng);
     }
 
+    if ( _encoding & ENCODING_DIRECTION_BLOCKS ) {
+	PutDirectionBlock( recipe._directions );
+	return *this;
+    }
+
     vector< CB_String >::const_iterator iDir = recipe._directions.begin();
     vector< CB_String >::const_iterator iDirEnd = recipe._directions.end();
 
@@ -1006,98 +5386,404 @@ CB_Stream::operator << (
     //...Sizes
     (*this) << book._recipes.size();
 
-    CB_Recipe_pVector_t::const_iterator iRec = book._recipes.begin();
-    CB_Recipe_pVector_t::const_iterator iRecEnd = book._recipes.end();
+    CB_Recipe_pVector_t::const_iterator iRec = book._recipes.begin();
+    CB_Recipe_pVector_t::const_iterator iRecEnd = book._recipes.end();
+
+    //...Recipes
+    for ( ; iRec != iRecEnd; iRec++ ) {
+	(*this) << *(*iRec);
+    }
+
+    return *this;
+}
+
+//PAGE
+// ************************************************************************
+CB_Stream&
+CB_Stream::operator >> (
+    CB_String&	s
+)
+// ************************************************************************
+{
+    if ( _isLiteral ) {
+	size_t n;
+	(*this) >> n;
+	const char* p = GetBytes( n );
+	s = (p != NULL) ? CB_String( p, n ) : CB_String();
+	return *this;
+    }
+
+    if ( _stringSource_p != NULL ) {
+	//...The characters of the address, into the table as a new string
+	size_t address;
+	(*this) >> address;
+	std::string_view text;
+	if ( !_isGood || !(*_stringSource_p)( address, text ) ) {
+	    _isGood = false;
+	    s = CB_String();
+	    return *this;
+	}
+	s = CB_String( text.data(), text.size() );
+	return *this;
+    }
+
+    //...Delete the current reference of this object. The new reference
+    //...is already counted by the string table read from the same stream.
+    s.Release();
+
+    size_t address;
+    (*this) >> address;
+
+    const CB_StringTable* table_p = s._theStringTable_p;
+    if ( address >= table_p -> _byAddress.size() ||
+			table_p -> _byAddress[ address ].string_p == NULL ) {
+	//...Not a string of the table: the file is inconsistent
+	_isGood = false;
+	s._address = s._theStringTable_p -> InsertEmpty();
+	return *this;
+    }
+
+    s._address = address;
+    return *this;
+}
+
+//PAGE
+// ************************************************************************
+CB_Stream&
+CB_Stream::operator >> (
+    CB_StringTable&	table
+)
+// ************************************************************************
+{
+    GetStringTable( table, 1 );
+    return *this;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::GetStringTable(
+    CB_StringTable&	table,
+    unsigned int	nThreads
+)
+// ************************************************************************
+//
+// Read a string table into an empty table. With more than one thread,
+// a pass over the sizes of the strings first finds where each chunk of
+// CB_PARALLEL_STRINGS strings begins, then up to nThreads threads
+// decode the chunks, each one into an arena of its own. Returns Good().
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+//TODO
+    //...Sizes
+    size_t byStringSize;
+    size_t byAddressSize;
+    size_t freeAddressesSize;
+
+    (*this) >> byStringSize;
+    (*this) >> byAddressSize;
+    (*this) >> freeAddressesSize;
+
+    //...Every entry takes at least three integers, every free address one
+    size_t intSize = MinIntSize();
+    if ( byStringSize > byAddressSize || freeAddressesSize > byAddressSize ||
+	 byStringSize > (size_t) (_end_p - _next_p) / (3 * intSize) ||
+	 freeAddressesSize > (size_t) (_end_p - _next_p) / intSize ) {
+	_isGood = false;
+	return false;
+    }
+
+    //...The blocks of a front-coded table; only FindString() needs them
+    bool isFrontCoded = (_encoding & ENCODING_FRONT_CODED) != 0;
+    size_t restart = 0;
+    if ( isFrontCoded ) {
+	size_t nBlocks;
+	(*this) >> restart;
+	(*this) >> nBlocks;
+	if ( restart == 0 || CB_PARALLEL_STRINGS % restart != 0 ||
+	     nBlocks != (byStringSize + restart - 1) / restart ||
+	     GetBytes( nBlocks * sizeof(uint32_t) ) == NULL ) {
+	    _isGood = false;
+	    return false;
+	}
+    }
+
+    table._slots.clear();
+    table._byAddress.resize( byAddressSize );
+    table._freeAddresses.resize( freeAddressesSize );
+
+    size_t nChunks = (byStringSize + CB_PARALLEL_STRINGS - 1) /
+						    CB_PARALLEL_STRINGS;
+    //...At least one, for the one chunk read here of an empty table
+    std::vector< CB_Address_t > emptyAddresses( max( nChunks, (size_t) 1 ),
+							    CB_NO_ADDRESS );
+
+    if ( nThreads <= 1 || nChunks <= 1 ) {
+	GetStrings( table, table._arena, 0, byStringSize, restart,
+						    emptyAddresses[0] );
+    }
+    else {
+	//...Where the chunks begin, and the strings end
+	std::vector< size_t > chunks;
+	size_t i;
+	for ( i = 0 ; i < byStringSize && _isGood ; i++ ) {
+	    if ( i % CB_PARALLEL_STRINGS == 0 ) {
+		chunks.push_back( Tell() );
+	    }
+	    size_t refCount;
+	    size_t address;
+	    size_t shared;
+	    size_t n;
+	    (*this) >> refCount >> address;
+	    if ( isFrontCoded ) {
+		(*this) >> shared;
+	    }
+	    (*this) >> n;
+	    GetBytes( n );
+	}
+
+	//...Chunk k by thread k % nThreads
+	nThreads = min( (size_t) nThreads, nChunks );
+	std::vector< CB_StringArena > arenas( nThreads );
+	std::vector< char > isValid( nThreads, 1 );
+	std::vector< std::thread > threads;
+
+	unsigned int t;
+	for ( t = 0 ; t < nThreads && _isGood ; t++ ) {
+	    threads.push_back( std::thread( [ &, t ] {
+		CB_Stream input( _sectionBegin_p, _end_p - _sectionBegin_p,
+							    _encoding );
+		size_t k;
+		for ( k = t ; k < nChunks && input.Good() ; k += nThreads ) {
+		    size_t first = k * CB_PARALLEL_STRINGS;
+		    input.Seek( chunks[k] );
+		    input.GetStrings( table, arenas[t], first,
+			    min( (size_t) CB_PARALLEL_STRINGS,
+				 byStringSize - first ),
+			    restart, emptyAddresses[k] );
+		}
+		isValid[t] = input.Good();
+	    } ) );
+	}
+	for ( t = 0 ; t < threads.size() ; t++ ) {
+	    threads[t].join();
+	    table._arena.Adopt( arenas[t] );
+	    if ( !isValid[t] ) {
+		_isGood = false;
+	    }
+	}
+    }
+
+    if ( !_isGood ) {
+	return false;
+    }
+
+    table._size += byStringSize;
+    std::vector< CB_Address_t >::const_iterator iEmpty;
+    for ( iEmpty = emptyAddresses.begin() ; iEmpty != emptyAddresses.end() ;
+								iEmpty++ ) {
+	if ( *iEmpty != CB_NO_ADDRESS ) {
+	    table._emptyAddress = *iEmpty;
+	}
+    }
 
-    //...Recipes
-    for ( ; iRec != iRecEnd; iRec++ ) {
-	(*this) << *(*iRec);
+    //...Free addresses
+    vector< CB_Address_t >::iterator itor = table._freeAddresses.begin();
+    vector< CB_Address_t >::iterator itorEnd = table._freeAddresses.end();
+
+    for ( ; itor != itorEnd ; itor++ ) {
+	size_t address;
+	(*this) >> address;
+	(*itor) = address;
     }
 
-    return *this;
+    return _isGood;
 }
 
 //PAGE
 // ************************************************************************
-CB_Stream&
-CB_Stream::operator >> (
-    CB_String&	s
+void
+CB_Stream::GetStrings(
+    CB_StringTable&	table,
+    CB_StringArena&	arena,
+    size_t		first,
+    size_t		nStrings,
+    size_t		restart,
+    CB_Address_t&	emptyAddress
 )
 // ************************************************************************
+//
+// Enter the strings first to first + nStrings - 1 of a string table,
+// at the current input, at their addresses in the table. The
+// characters go into arena. Threads may do so at once for the same
+// table: every address is claimed atomically, and only the one that
+// claims it fills it in. The address of "" is left in emptyAddress.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    //...Delete the current reference of this object
-    assert( (*(s._itor)).second.refCount > 0 );
-    (*(s._itor)).second.refCount--;
-    if ( (*(s._itor)).second.refCount == 0 ) {
-	s._theStringTable_p -> Erase( s._itor );
-    }
+    bool isFrontCoded = (_encoding & ENCODING_FRONT_CODED) != 0;
+    size_t byAddressSize = table._byAddress.size();
+    std::string previous;
 
-    size_t address;
-    (*this) >> address;
-    s._itor = s._theStringTable_p -> _byAddress[ address ];
-    return *this;
+    //...For all strings
+    size_t i = 0;
+    for ( i = first ; i < first + nStrings ; i ++ ) {
+	size_t refCount;
+	size_t address;
+	(*this) >> refCount;
+	(*this) >> address;
+
+	size_t shared = 0;
+	if ( isFrontCoded ) {
+	    (*this) >> shared;
+	}
+
+	size_t n;
+	(*this) >> n;
+
+	//...The characters, in place
+	const char* p = GetBytes( n );
+	if ( p == NULL || address >= byAddressSize ||
+			    shared > previous.size() ||
+			    (shared != 0 && i % restart == 0) ) {
+	    _isGood = false;
+	    break;
+	}
+
+	//...The characters, after the prefix of the string before
+	if ( isFrontCoded ) {
+	    previous.resize( shared );
+	    previous.append( p, n );
+	    p = previous.data();
+	    n = previous.size();
+	}
+
+	//...Enter the string into the table at its address
+	CB_StringData& data = table._byAddress[ address ];
+	const char* string_p = arena.Allocate( p, n );
+	const char* none_p = NULL;
+	if ( !std::atomic_ref< const char* >( data.string_p ).
+			compare_exchange_strong( none_p, string_p ) ) {
+	    _isGood = false;
+	    break;
+	}
+	data.length = n;
+	data.refCount = refCount;
+
+	if ( n == 0 ) {
+	    emptyAddress = address;
+	}
+    }
 }
 
 //PAGE
 // ************************************************************************
-CB_Stream&
-CB_Stream::operator >> (
-    CB_StringTable&	table
+bool
+CB_Stream::FindString(
+    const char*	s,
+    size_t	l,
+    size_t&	address
 )
 // ************************************************************************
+//
+// Look a string up in the front-coded string table of the current
+// section, without reading the table: a binary search of the first
+// strings of the blocks, then a scan of one block. Returns false if
+// there is no such string, or if the table is not front-coded.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-//TODO
-    //...Sizes
+    if ( (_encoding & ENCODING_FRONT_CODED) == 0 || !Seek( 0 ) ) {
+	return false;
+    }
+
     size_t byStringSize;
     size_t byAddressSize;
     size_t freeAddressesSize;
+    size_t restart;
+    size_t nBlocks;
 
     (*this) >> byStringSize;
     (*this) >> byAddressSize;
     (*this) >> freeAddressesSize;
+    (*this) >> restart;
+    (*this) >> nBlocks;
 
-    table._byAddress.resize( byAddressSize );
-    table._freeAddresses.resize( freeAddressesSize );
+    if ( !Good() || restart == 0 ||
+	 nBlocks != (byStringSize + restart - 1) / restart ) {
+	return false;
+    }
 
-    //...Input buffer
-    string inString;
+    const char* offsets_p = GetBytes( nBlocks * sizeof(uint32_t) );
+    if ( offsets_p == NULL ) {
+	return false;
+    }
+    size_t blocksBegin = Tell();
+    std::string key( s, l );
 
-    CB_StringTable_t::iterator iStr = table._byString.begin();
+    //...The first block that starts after the string
+    size_t low = 0;
+    size_t high = nBlocks;
+    while ( low < high ) {
+	size_t mid = (low + high) / 2;
+	uint32_t offset;
+	memcpy( &offset, offsets_p + mid * sizeof(uint32_t), sizeof(uint32_t) );
 
-    //...For all strings
-    size_t i = 0;
-    for ( i = 0 ; i < byStringSize ; i ++ ) {
 	size_t refCount;
-	size_t address;
-	(*this) >> refCount;
-	(*this) >> address;
-
+	size_t first;
+	size_t shared;
 	size_t n;
-	(*this) >> n;
+	Seek( blocksBegin + offset );
+	(*this) >> refCount >> first >> shared >> n;
 
-	inString.resize( n , ' ' );
-	//...Write into the string: cast as not const
-	fread( (char*) inString.data(), 1, n, _file );
+	const char* p = GetBytes( n );
+	if ( p == NULL || shared != 0 ) {
+	    _isGood = false;
+	    return false;
+	}
 
-	//...Insert the string into the table (at the end)
-	iStr = table._byString.insert( iStr,
-				CB_StringTable_t::value_type( inString,
-					CB_StringData(refCount,address) ) );
+	if ( key.compare( 0, std::string::npos, p, n ) < 0 ) {
+	    high = mid;
+	}
+	else {
+	    low = mid + 1;
+	}
+    }
+    if ( low == 0 ) {
+	return false;
+    }
 
-	//...Save the string pointer in the address vector
-	table._byAddress[ address ] = iStr;
+    //...The string can only be in the block before
+    size_t block = low - 1;
+    uint32_t offset;
+    memcpy( &offset, offsets_p + block * sizeof(uint32_t), sizeof(uint32_t) );
+    Seek( blocksBegin + offset );
 
-    }
+    size_t nString = min( restart, byStringSize - block * restart );
+    std::string current;
 
-    //...Free addresses
-    vector< size_t >::iterator itor = table._freeAddresses.begin();
-    vector< size_t >::iterator itorEnd = table._freeAddresses.end();
+    size_t i;
+    for ( i = 0 ; i < nString ; i++ ) {
+	size_t refCount;
+	size_t shared;
+	size_t n;
+	(*this) >> refCount >> address >> shared >> n;
 
-    for ( ; itor != itorEnd ; itor++ ) {
-	(*this) >> (*itor);
-    }
+	const char* p = GetBytes( n );
+	if ( p == NULL || shared > current.size() ) {
+	    _isGood = false;
+	    return false;
+	}
+	current.resize( shared );
+	current.append( p, n );
 
-    return *this;
+	int compare = current.compare( key );
+	if ( compare >= 0 ) {
+	    return compare == 0;
+	}
+    }
+    return false;
 }
 
 //PAGE
@@ -1124,6 +5810,8 @@ CB_Stream::operator >> (
 )
 // ************************************************************************
 {
+    const char* recipeBegin_p = _next_p;
+
 //TODO
     //...Sizes
     size_t nIngredients;
@@ -1132,6 +5820,16 @@ CB_Stream::operator >> (
     (*this) >> nIngredients;
     (*this) >> nDirections;
 
+    //...Every ingredient takes four integers, every direction one
+    //...unless the directions are in a block
+    bool isInBlock = (_encoding & ENCODING_DIRECTION_BLOCKS) != 0;
+    size_t intSize = MinIntSize();
+    if ( nIngredients > (size_t) (_end_p - _next_p) / (4 * intSize) ||
+	 (!isInBlock && nDirections > (size_t) (_end_p - _next_p) / intSize) ) {
+	_isGood = false;
+	return *this;
+    }
+
     //...Single strings
     (*this) >> recipe._name;
     (*this) >> recipe._serves;
@@ -1141,6 +5839,63 @@ CB_Stream::operator >> (
     (*this) >> recipe._category4;
     (*this) >> recipe._date;
 
+    if ( !_isLazy ) {
+	GetRecipeBody( recipe, nIngredients, nDirections );
+	return *this;
+    }
+
+    //...Lazy: check the ingredients and directions, decode them later
+    CB_StringTable* table_p = CB_StringTable::Current();
+    size_t nAddresses = 4 * nIngredients + (isInBlock ? 0 : nDirections);
+    size_t i;
+    for ( i = 0 ; i < nAddresses && _isGood ; i++ ) {
+	size_t address;
+	(*this) >> address;
+	if ( !table_p -> Contains( address ) ) {
+	    _isGood = false;
+	}
+    }
+
+    //...Only the block is checked: it is inflated with the recipe
+    if ( isInBlock ) {
+	size_t block;
+	size_t offset;
+	(*this) >> block;
+	(*this) >> offset;
+	if ( _directionSource_p == NULL ||
+	     !_directionSource_p -> LoadDirections() ||
+	     block >= _directionSource_p -> _directionBlocks.size() ) {
+	    _isGood = false;
+	}
+    }
+
+    if ( _isGood ) {
+	CB_LazyRecipe* lazy_p = new CB_LazyRecipe;
+	lazy_p -> begin_p = recipeBegin_p;
+	lazy_p -> end_p = _next_p;
+	lazy_p -> table_p = table_p;
+	lazy_p -> encoding = _encoding;
+	lazy_p -> directionSource_p = _directionSource_p;
+	delete recipe._lazy_p;
+	recipe._lazy_p = lazy_p;
+    }
+    return *this;
+}
+
+//PAGE
+// ************************************************************************
+void
+CB_Stream::GetRecipeBody(
+    CB_Recipe&	recipe,
+    size_t	nIngredients,
+    size_t	nDirections
+)
+// ************************************************************************
+//
+// The ingredients and directions of a recipe, after its single strings.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
     //...Ingredients
     size_t i;
     for ( i = 0 ; i < nIngredients ; i++ ) {
@@ -1150,6 +5905,19 @@ CB_Stream::operator >> (
     }
 
     //...Directions
+    if ( _encoding & ENCODING_DIRECTION_BLOCKS ) {
+	size_t block;
+	size_t offset;
+	(*this) >> block;
+	(*this) >> offset;
+	if ( _directionSource_p == NULL ||
+	     !_directionSource_p -> GetDirections( recipe._directions,
+					nDirections, block, offset ) ) {
+	    _isGood = false;
+	}
+	return;
+    }
+
     recipe._directions.resize( nDirections );
     vector< CB_String >::iterator iDir = recipe._directions.begin();
     vector< CB_String >::iterator iDirEnd = recipe._directions.end();
@@ -1157,8 +5925,288 @@ CB_Stream::operator >> (
     for ( ; iDir != iDirEnd; iDir++ ) {
 	(*this) >> (*iDir);
     }
+}
 
-    return *this;
+//PAGE
+// ************************************************************************
+void
+CB_Stream::PutDirectionBlock(
+    const std::vector< CB_String >&	directions
+)
+// ************************************************************************
+//
+// Add the directions of a recipe to the text of the last directions
+// block, or of a new one once it is full, and put out that block and
+// their offset in it. The directions are written as characters, in the
+// encoding of the output, and moved from the output into the block.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    if ( _directionText.empty() ||
+	 _directionText.back().size() >= CB_DIRECTIONS_BLOCK ) {
+	_directionText.push_back( std::string() );
+    }
+    std::string& text = _directionText.back();
+    size_t block = _directionText.size() - 1;
+    size_t offset = text.size();
+
+    size_t begin = _buffer.size();
+    bool isLiteral = _isLiteral;
+    _isLiteral = true;
+
+    vector< CB_String >::const_iterator iDir = directions.begin();
+    vector< CB_String >::const_iterator iDirEnd = directions.end();
+
+    for ( ; iDir != iDirEnd; iDir++ ) {
+	(*this) << (*iDir);
+    }
+
+    _isLiteral = isLiteral;
+    text.append( _buffer.data() + begin, _buffer.size() - begin );
+    _buffer.resize( begin );
+
+    (*this) << block;
+    (*this) << offset;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::PutDirections(
+    const std::string&	dictionary
+)
+// ************************************************************************
+//
+// The DIRECTIONS section, from the blocks of the recipes written before
+// with ENCODING_DIRECTION_BLOCKS, in the same integer encoding: the
+// dictionary, the number of blocks, the offset, size and text size of
+// each one, then their bytes, each deflated by itself with the
+// dictionary. Returns false if a block cannot be deflated.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    std::vector< std::string > data( _directionText.size() );
+
+    size_t i;
+    for ( i = 0 ; i < data.size() ; i++ ) {
+	if ( !Deflate( _directionText[i], dictionary, data[i] ) ) {
+	    return false;
+	}
+    }
+
+    (*this) << dictionary.size();
+    PutBytes( dictionary.data(), dictionary.size() );
+
+    (*this) << data.size();
+    size_t offset = 0;
+    for ( i = 0 ; i < data.size() ; i++ ) {
+	(*this) << offset;
+	(*this) << data[i].size();
+	(*this) << _directionText[i].size();
+	offset += data[i].size();
+    }
+
+    for ( i = 0 ; i < data.size() ; i++ ) {
+	PutBytes( data[i].data(), data[i].size() );
+    }
+
+    _directionText.clear();
+    return true;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::LoadDirections()
+// ************************************************************************
+//
+// Find the dictionary and the blocks of the DIRECTIONS section of the
+// input, the first time they are needed. Returns false if the section
+// is missing or inconsistent.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    if ( _directionData_p != NULL ) {
+	return true;
+    }
+
+    std::vector< CB_SectionEntry >::const_iterator iSec = _sections.begin();
+    std::vector< CB_SectionEntry >::const_iterator iSecEnd = _sections.end();
+
+    for ( ; iSec != iSecEnd ; iSec++ ) {
+	if ( (*iSec).id == SECTION_DIRECTIONS ) {
+	    break;
+	}
+    }
+    if ( iSec == iSecEnd || ((*iSec).encoding & ~ENCODING_ALL) != 0 ) {
+	return false;
+    }
+
+    CB_Stream section( _begin_p + (*iSec).offset, (*iSec).size,
+						    (*iSec).encoding );
+
+    size_t dictionarySize;
+    section >> dictionarySize;
+    const char* dictionary_p = section.GetBytes( dictionarySize );
+
+    //...Every block takes three integers
+    size_t nBlocks;
+    section >> nBlocks;
+    if ( !section.Good() ||
+	 nBlocks > section.Remaining() / (3 * section.MinIntSize()) ) {
+	return false;
+    }
+
+    std::vector< CB_DirectionBlock > blocks( nBlocks );
+    size_t i;
+    for ( i = 0 ; i < nBlocks ; i++ ) {
+	section >> blocks[i].offset;
+	section >> blocks[i].size;
+	section >> blocks[i].textSize;
+    }
+
+    //...Deflate cannot shrink text more than about a thousand times
+    size_t dataSize = section.Remaining();
+    for ( i = 0 ; i < nBlocks ; i++ ) {
+	const CB_DirectionBlock& block = blocks[i];
+	if ( block.size > dataSize || block.offset > dataSize - block.size ||
+	     block.textSize / 1024 > block.size ) {
+	    return false;
+	}
+    }
+    if ( !section.Good() ) {
+	return false;
+    }
+
+    _directionBlocks.swap( blocks );
+    _dictionary_p = dictionary_p;
+    _dictionarySize = dictionarySize;
+    _directionData_p = section._next_p;
+    _directionEncoding = (*iSec).encoding;
+    return true;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::GetDirections(
+    std::vector< CB_String >&	directions,
+    size_t			nDirections,
+    size_t			block,
+    size_t			offset
+)
+// ************************************************************************
+//
+// The directions of a recipe at an offset into a directions block of
+// the input, inflating the block unless it was the last one.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    if ( !LoadDirections() || block >= _directionBlocks.size() ) {
+	return false;
+    }
+
+    if ( block != _directionBlockNo ) {
+	_directionBlockNo = (size_t) -1;
+	if ( !Inflate( _directionBlocks[ block ] ) ) {
+	    return false;
+	}
+	_directionBlockNo = block;
+    }
+
+    CB_Stream text( _directionBlock.data(), _directionBlock.size(),
+						    _directionEncoding );
+    text.Set_isLiteral();
+
+    //...Every direction takes one integer
+    if ( !text.Seek( offset ) ||
+	 nDirections > text.Remaining() / text.MinIntSize() ) {
+	return false;
+    }
+
+    directions.resize( nDirections );
+    vector< CB_String >::iterator iDir = directions.begin();
+    vector< CB_String >::iterator iDirEnd = directions.end();
+
+    for ( ; iDir != iDirEnd; iDir++ ) {
+	text >> (*iDir);
+    }
+    return text.Good();
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::Deflate(
+    const std::string&	text,
+    const std::string&	dictionary,
+    std::string&	data
+)
+// ************************************************************************
+{
+    z_stream z;
+    memset( &z, 0, sizeof(z) );
+    if ( deflateInit( &z, Z_BEST_COMPRESSION ) != Z_OK ) {
+	return false;
+    }
+
+    int status = Z_OK;
+    if ( !dictionary.empty() ) {
+	status = deflateSetDictionary( &z, (const Bytef*) dictionary.data(),
+						    dictionary.size() );
+    }
+
+    if ( status == Z_OK ) {
+	data.resize( deflateBound( &z, text.size() ) );
+	z.next_in = (Bytef*) text.data();
+	z.avail_in = text.size();
+	z.next_out = (Bytef*) &data[0];
+	z.avail_out = data.size();
+	status = deflate( &z, Z_FINISH );
+	data.resize( z.total_out );
+    }
+
+    deflateEnd( &z );
+    return status == Z_STREAM_END;
+}
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::Inflate(
+    const CB_DirectionBlock&	block
+)
+// ************************************************************************
+//
+// Inflate a directions block into _directionBlock.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    z_stream z;
+    memset( &z, 0, sizeof(z) );
+    if ( inflateInit( &z ) != Z_OK ) {
+	return false;
+    }
+
+    _directionBlock.resize( block.textSize );
+    z.next_in = (Bytef*) (_directionData_p + block.offset);
+    z.avail_in = block.size;
+    z.next_out = (Bytef*) &_directionBlock[0];
+    z.avail_out = _directionBlock.size();
+
+    int status = inflate( &z, Z_FINISH );
+    if ( status == Z_NEED_DICT ) {
+	status = inflateSetDictionary( &z, (const Bytef*) _dictionary_p,
+							_dictionarySize );
+	if ( status == Z_OK ) {
+	    status = inflate( &z, Z_FINISH );
+	}
+    }
+
+    bool isInflated = status == Z_STREAM_END &&
+					z.total_out == block.textSize;
+    inflateEnd( &z );
+    return isInflated;
 }
 
 //PAGE
@@ -1175,7 +6223,7 @@ CB_Stream::operator >> (
 
     //...Recipes
     size_t i;
-    for ( i = 0 ; i < nRecipes ; i++ ) {
+    for ( i = 0 ; i < nRecipes && _isGood ; i++ ) {
 	CB_Recipe* recipe_p = new CB_Recipe();
 	book._recipes.push_back( recipe_p );
 	(*this) >> (*recipe_p);
@@ -1183,3 +6231,91 @@ CB_Stream::operator >> (
 
     return *this;
 }
+
+//PAGE
+// ************************************************************************
+bool
+CB_Stream::GetRecipes(
+    CB_Book&				book,
+    const std::vector< size_t >&	offsets,
+    unsigned int			nThreads
+)
+// ************************************************************************
+//
+// The recipes of a book, as >> CB_Book reads them, decoded by up to
+// nThreads threads from their offsets in the current section, each
+// recipe checked to end where the next one begins. Returns Good().
+//
+// The threads share the current string table, which counts no
+// references while they run: the counts read with the table are those
+// of the recipes already. A table without "" is read by this thread
+// alone, since every new CB_String would insert it, and so are recipes
+// with directions to inflate: that enters their strings.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    CB_StringTable* table_p = CB_StringTable::Current();
+    bool isInBlock = (_encoding & ENCODING_DIRECTION_BLOCKS) != 0;
+
+    size_t nRecipes;
+    (*this) >> nRecipes;
+
+    if ( nThreads <= 1 || nRecipes < 2 || nRecipes != offsets.size() ||
+	 table_p -> _emptyAddress == CB_NO_ADDRESS ||
+	 (isInBlock && !_isLazy) ||
+	 (isInBlock && (_directionSource_p == NULL ||
+			!_directionSource_p -> LoadDirections())) ) {
+	Seek( 0 );
+	(*this) >> book;
+	return _isGood;
+    }
+
+    //...Recipes [ n * t / nThreads, n * (t + 1) / nThreads ) by thread t
+    nThreads = min( (size_t) nThreads, nRecipes );
+    book._recipes.resize( nRecipes );
+    std::vector< char > isValid( nThreads, 1 );
+    std::vector< std::thread > threads;
+
+    bool isImmortal = table_p -> Get_isImmortal();
+    table_p -> Set_isImmortal();
+
+    unsigned int t;
+    for ( t = 0 ; t < nThreads ; t++ ) {
+	threads.push_back( std::thread( [ &, t ] {
+	    CB_StringTableScope scope( *table_p );
+	    CB_Stream input( _sectionBegin_p, _end_p - _sectionBegin_p,
+							    _encoding );
+	    input._isLazy = _isLazy;
+	    input._directionSource_p = _directionSource_p;
+
+	    size_t i;
+	    size_t first = nRecipes * t / nThreads;
+	    size_t last = nRecipes * (t + 1) / nThreads;
+	    for ( i = first ; i < last ; i++ ) {
+		book._recipes[i] = new CB_Recipe();
+		if ( input.Good() && input.Seek( offsets[i] ) ) {
+		    input >> *book._recipes[i];
+		}
+		if ( i + 1 < nRecipes && input.Tell() != offsets[i + 1] ) {
+		    input._isGood = false;
+		}
+	    }
+	    isValid[t] = input.Good();
+	} ) );
+    }
+    for ( t = 0 ; t < nThreads ; t++ ) {
+	threads[t].join();
+	if ( !isValid[t] ) {
+	    _isGood = false;
+	}
+    }
+
+    table_p -> Set_isImmortal( isImmortal );
+
+    //...The first recipe begins after the count; the last ends the section
+    if ( offsets[0] != Tell() ||
+	 offsets.back() > (size_t) (_end_p - _sectionBegin_p) ) {
+	_isGood = false;
+    }
+    return _isGood;
+}
@@ -23,8 +23,13 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
 #include <map>
+#include <unordered_map>
 #include <set>
 
 #include <string.h>
@@ -32,11 +37,15 @@
 #include <inttypes.h>
 
 class CB_String;
+class CB_StringRef;
 class CB_StringTable;
+class CB_StringTableScope;
 
 class CB_Ingredient;
 class CB_Recipe;
 class CB_Book;
+class CB_BookFile;
+class CB_FrozenBook;
 
 class CB_Stream;
 
@@ -45,21 +54,226 @@ class CB_Display;
 typedef std::vector< CB_Ingredient* >		CB_Ingredient_pVector_t;
 typedef std::vector< CB_Recipe* >		CB_Recipe_pVector_t;
 
+typedef uint32_t				CB_Address_t;
+
+//...Address of no string: the state of a moved from CB_String
+#define CB_NO_ADDRESS	((CB_Address_t) 0xffffffff)
+
+//PAGE
+// ************************************************************************
+// The .cbd file format
+// ************************************************************************
+//
+// Version 1 is a bare sequence of int32 values and characters: the
+// string table followed by the recipes.
+//
+// Version 2 wraps the same data into sections:
+//
+//	CB_FileHeader
+//	sections, each one a contiguous range of bytes
+//	CB_SectionEntry[ nSections ]	//...the section directory
+//
+// The header and the directory are checked by their own checksums, and
+// every section by the checksum in its directory entry (all CRC-32).
+//
+// Sections (CB_Stream::SECTION_...):
+//
+//	STRINGS		the string table, as in version 1, or front-coded
+//			in blocks (see CB_Stream::PutStringTable)
+//	RECIPES		the recipes, as in version 1
+//	INDEXES		optional, the sorted indices of the book
+//	RECIPE_INDEX	the number of recipes n, n pairs of (offset of
+//			the recipe in RECIPES, address of its name), and
+//			the n recipe numbers in name order
+//	DIRECTIONS	optional, the directions of the recipes, compressed
+//			in blocks; the recipes then hold the block and the
+//			offset of theirs (CB_Stream::ENCODING_DIRECTION_BLOCKS)
+//	RECIPE_IDS	optional, the next id of the book, the number of
+//			recipes n, and the n recipe ids (64 bits) in order
+//
+// The journal (.cbj) next to a .cbd file records the changes made to
+// the book since the .cbd file was written (see CB_Book):
+//
+//	CB_JOURNAL_MAGIC, CRC-32 of all of the .cbd file
+//	records: int32 size, CRC-32 of the data, data
+//
+// The data of a record is its type, a recipe number and, for adding
+// and modifying, the recipe. Strings are written out as their length
+// and characters, not as addresses.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+#define CB_FILE_MAGIC		"CBD2"
+#define CB_FILE_VERSION		2
+#define CB_JOURNAL_MAGIC	"CBJ1"
+
+struct CB_FileHeader
+{
+    char	magic[4];
+    uint32_t	version;
+    uint32_t	flags;
+    uint32_t	nSections;
+    uint64_t	directoryOffset;
+    uint32_t	directoryChecksum;
+    uint32_t	headerChecksum;		//...Of the bytes before it
+};
+
+struct CB_SectionEntry
+{
+    uint32_t	id;
+    uint32_t	encoding;
+    uint64_t	offset;
+    uint64_t	size;
+    uint32_t	checksum;
+    uint32_t	reserved;
+};
+
+//...A block of the DIRECTIONS section: where its compressed bytes are,
+//...after the block table, and how many bytes they inflate to
+struct CB_DirectionBlock
+{
+    size_t	offset;
+    size_t	size;
+    size_t	textSize;
+};
+
+//PAGE
+// ************************************************************************
+// The .cbf frozen book image
+// ************************************************************************
+//
+// An immutable image of a book, used where it lies in memory: recipes,
+// ingredients and index entries are arrays of records of fixed size,
+// which refer to each other by number and to their strings by offset
+// into one array of NUL terminated characters. Nothing in it is a
+// pointer, so any number of processes can map it, anywhere, and query
+// it without decoding it (see CB_FrozenBook).
+//
+//	CB_FrozenHeader, with the offset and the count of each table
+//	tables, each one aligned to 8 bytes (CB_FrozenBook::TABLE_...):
+//
+//	STRINGS		the characters of the strings, "" at offset 0
+//	RECIPES		CB_FrozenRecipe[], in book order
+//	INGREDIENTS	CB_FrozenIngredient[], those of each recipe in turn
+//	DIRECTIONS	CB_FrozenString[], those of each recipe in turn
+//	BY_NAME		uint32_t[], the recipe numbers in name order
+//	BY_CATEGORY	CB_FrozenEntry[], in category order
+//	BY_INGREDIENT	CB_FrozenEntry[], in ingredient order
+//	..._NAMES	CB_FrozenString[], the sorted names of categories,
+//			quantities, measurements, preparations and
+//			ingredients
+//
+// The image has the byte order of the machine that wrote it, and is
+// refused by a machine of the other order.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+#define CB_FROZEN_MAGIC		"CBF1"
+#define CB_FROZEN_VERSION	1
+#define CB_FROZEN_BYTE_ORDER	0x01020304
+#define CB_FROZEN_TABLES	12
+
+struct CB_FrozenTable
+{
+    uint64_t	offset;		//...From the start of the image
+    uint64_t	count;		//...Of elements
+};
+
+struct CB_FrozenHeader
+{
+    char		magic[4];
+    uint32_t		version;
+    uint32_t		byteOrder;	//...CB_FROZEN_BYTE_ORDER
+    uint32_t		nTables;
+    CB_FrozenTable	tables[ CB_FROZEN_TABLES ];
+    uint32_t		dataChecksum;	//...Of the bytes after the header
+    uint32_t		headerChecksum;	//...Of the bytes before it
+};
+
+//...Characters at offset in STRINGS, followed by a NUL
+struct CB_FrozenString
+{
+    uint32_t	offset;
+    uint32_t	length;
+};
+
+struct CB_FrozenIngredient
+{
+    CB_FrozenString	quantity;
+    CB_FrozenString	measurement;
+    CB_FrozenString	preparation;
+    CB_FrozenString	ingredient;
+};
+
+struct CB_FrozenRecipe
+{
+    CB_FrozenString	name;
+    CB_FrozenString	serves;
+    CB_FrozenString	category1;
+    CB_FrozenString	category2;
+    CB_FrozenString	category3;
+    CB_FrozenString	category4;
+    CB_FrozenString	date;
+    uint32_t		firstIngredient;	//...In INGREDIENTS
+    uint32_t		nIngredients;
+    uint32_t		firstDirection;		//...In DIRECTIONS
+    uint32_t		nDirections;
+};
+
+//...An entry of BY_CATEGORY or BY_INGREDIENT
+struct CB_FrozenEntry
+{
+    CB_FrozenString	key;
+    uint32_t		recipe;		//...Recipe number
+};
+
 //PAGE
 // ************************************************************************
 struct CB_StringData
 // ************************************************************************
 //
 // Part of the String Table implementation. This information is kept
-// for each string that exists in the String Table.
+// for each address of the String Table; the address is its index.
+// The characters themselves live in the arena of the table and are
+// always NUL terminated. An unused address has a NULL string_p.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+    const char*	string_p;
+    uint32_t	length;
+    uint32_t	refCount;
+
+    CB_StringData() : string_p(NULL), length(0), refCount(0) {}
+};
+
+//...One slot of the string hash table: address + 1 (0 if empty) and hash
+struct CB_StringSlot
+{
+    CB_Address_t	address1;
+    uint32_t		hash;
+};
+
+//PAGE
+// ************************************************************************
+struct CB_StringArena
+// ************************************************************************
+//
+// Part of the String Table implementation: the characters of the strings,
+// copied into large blocks that never move. A thread that decodes
+// strings for a table fills an arena of its own, which the table then
+// takes over with Adopt().
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
-    size_t	refCount;
-    size_t	address;
+    std::vector< std::unique_ptr< char[] > >	blocks;
+    char*					next_p;
+    size_t					left;
 
-    CB_StringData() : refCount(0), address(0) {}
-    CB_StringData( size_t c, size_t a) : refCount(c), address(a) {}
+    CB_StringArena() : next_p( NULL ), left( 0 ) {}
+
+    const char*	Allocate( const char* s, size_t l );
+    void	Adopt( CB_StringArena& o );
+    void	Clear();
 };
 
 //PAGE
@@ -75,12 +289,9 @@ struct LT_String {
     }
 };
 
-typedef std::map< std::string, CB_StringData, LT_String >
-						CB_StringTable_t;
-typedef std::vector< CB_StringTable_t::iterator >
-						CB_StringItorVector_t;
+typedef std::vector< CB_StringData >		CB_StringDataVector_t;
 
-std::ostream&	operator << ( std::ostream& o, const CB_String s );
+std::ostream&	operator << ( std::ostream& o, CB_StringRef s );
 
 //PAGE
 // ************************************************************************
@@ -100,8 +311,11 @@ class CB_String
 //	dtor
 //	copy ctor
 //	assignment operator
+//	move ctor
+//	move assignment operator
 //
 //	CB_String( const char* s, size_t sLength )
+//	CB_String( CB_StringRef s )	//...A new reference to a borrowed string
 //
 // Accessor functions:
 // ===================
@@ -117,12 +331,24 @@ class CB_String
 // Implementation Notes:
 // =====================
 //
+// The table a CB_String lives in is the current string table of the
+// thread, see CB_StringTableScope. A string must be copied and destroyed
+// while the table it was created in is current.
+//
+// Moving a CB_String does not touch the reference count; the moved from
+// object is left with CB_NO_ADDRESS and may only be destroyed or
+// assigned to.
+//
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
 
 public:
     
+    friend class CB_Book;
     friend class CB_Stream;
+    friend class CB_StringRef;
+    friend class CB_StringTable;
+    friend class CB_StringTableScope;
 
     //--------------------------------------------------
     // Manager functions: constructors, destructors,
@@ -134,37 +360,122 @@ public:
 
     ~CB_String();
 
+    explicit CB_String( CB_StringRef s );
+
     CB_String( const CB_String& o );
     CB_String& operator=( const CB_String& o );
 
+    CB_String( CB_String&& o ) noexcept : _address( o._address )
+				{ o._address = CB_NO_ADDRESS; }
+    CB_String& operator=( CB_String&& o ) noexcept
+				{
+				    std::swap( _address, o._address );
+				    return *this;
+				}
+
     //--------------------------------------------------
     // Accessor functions: Get_dataMember; Set_dataMember
     //--------------------------------------------------
+    CB_Address_t	Get_address() const { return _address; }
 
     //--------------------------------------------------
     // Implementation functions
     //--------------------------------------------------
-    const char*		c_str() const { return (*_itor).first.c_str(); }
-    const size_t	size() const { return (*_itor).first.size(); }
-    const std::string&  str() const { return (*_itor).first; }
+    inline const char*	c_str() const;
+    inline const size_t	size() const;
+    std::string		str() const { return std::string( c_str(), size() ); }
 
 #if 0
     bool		IsSameAs( const CB_String o )
-				{ return _stricmp( (*_itor).first.c_str(),
-					   (*(o._itor)).first.c_str() ) == 0; }
+				{ return _stricmp( c_str(), o.c_str() ) == 0; }
 #endif
 
 protected:
 
 private:
 
+    //--------------------------------------------------
+    // Implementation functions
+    //--------------------------------------------------
+    inline CB_StringData&	Data() const;
+
+    void			AddReference() const;
+    void			Release();
+
     //--------------------------------------------------
     // Data Members
     //--------------------------------------------------
 
-    static CB_StringTable*		_theStringTable_p;
+    static thread_local CB_StringTable*	_theStringTable_p;
 
-    CB_StringTable_t::iterator		_itor;
+    CB_Address_t			_address;
+};
+
+//PAGE
+// ************************************************************************
+class CB_StringRef
+// ************************************************************************
+//
+// Description:
+// ============
+//
+// A CB_StringRef is a borrowed, read-only view of a string in the
+// current string table. It does not keep the string alive, so it must
+// not outlive the CB_String it was made from; in exchange, making and
+// copying one never touches the reference count.
+//
+// Manager functions:
+// ==================
+//
+//	CB_StringRef( const CB_String& s )
+//	CB_StringRef( CB_Address_t address )
+//
+// Implementation functions:
+// =========================
+//
+//	char*	c_str()
+//	size_t	size()
+//	string	str()
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+
+public:
+
+    friend class CB_String;
+    friend class CB_Stream;
+
+    //--------------------------------------------------
+    // Manager functions: constructors, destructors,
+    // assignment operators, type conversion operators
+    //--------------------------------------------------
+    CB_StringRef( const CB_String& s ) : _address( s._address ) {}
+    explicit CB_StringRef( CB_Address_t a ) : _address( a ) {}
+
+    //--------------------------------------------------
+    // Accessor functions: Get_dataMember; Set_dataMember
+    //--------------------------------------------------
+    CB_Address_t	Get_address() const { return _address; }
+
+    //--------------------------------------------------
+    // Implementation functions
+    //--------------------------------------------------
+    inline const char*	c_str() const;
+    inline const size_t	size() const;
+    std::string		str() const { return std::string( c_str(), size() ); }
+
+    bool		operator == ( CB_StringRef o ) const
+				{ return _address == o._address; }
+    bool		operator != ( CB_StringRef o ) const
+				{ return _address != o._address; }
+
+private:
+
+    //--------------------------------------------------
+    // Data Members
+    //--------------------------------------------------
+
+    CB_Address_t	_address;
 };
 
 //PAGE
@@ -191,49 +502,84 @@ class CB_StringTable
 // =========================
 //
 //	size_t				Size() const
+//	size_t				AddressSize() const
+//	bool				Contains( size_t address ) const
 //	void				Clear()
 //	void				Print( ostream& o );
 //
+//	void				Set_isImmortal()
+//
+//	static CB_StringTable*		Current()
+//
 // Private. These are for use by friend CB_String.
 //
-//	CB_StringTable_t::iterator	Insert( const char* s, size_t sLength );
-//	void				Erase(CB_StringTable_t::iterator itor)
+//	CB_Address_t			Insert( const char* s, size_t sLength );
+//	void				Erase( CB_Address_t address )
 //
 // Implementation Notes:
 // =====================
 //
+// Strings are interned in an open addressing hash table (linear probing,
+// power of two capacity) whose slots hold address + 1, 0 meaning empty,
+// and the hash of the string. Erased strings are removed by shifting the
+// rest of their probe run back, so there are no tombstones.
+//
+// The characters are copied once into an arena of large blocks, so
+// string_p never moves while the string is alive. The bytes of an erased
+// string are only reclaimed by Clear().
+//
+// An immortal table does no reference counting at all: strings are
+// never erased until the table is cleared. This is the read only mode
+// of CB_Book; it is reset by Clear().
+//
+// The address of a string is the index of its CB_StringData in
+// _byAddress; this is what CB_Stream persists, and all a CB_String
+// holds. Sorted order is only computed on demand (Print and CB_Stream
+// output) by SortedAddresses().
+//
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
 
 public:
     
     friend class CB_String;
+    friend class CB_StringRef;
     friend class CB_Stream;
 
     //--------------------------------------------------
     // Manager functions: constructors, destructors,
     // assignment operators, type conversion operators
     //--------------------------------------------------
-    CB_StringTable() {}
+    CB_StringTable() :
+	_size(0), _emptyAddress( CB_NO_ADDRESS ), _isImmortal( false ) {}
     ~CB_StringTable() {}
 
     //--------------------------------------------------
     // Accessor functions: Get_dataMember; Set_dataMember
     //--------------------------------------------------
+    void			Set_isImmortal( bool v = true )
+				    { _isImmortal = v; }
+    bool			Get_isImmortal() const
+				    { return _isImmortal; }
 
     //--------------------------------------------------
     // Implementation functions
     //--------------------------------------------------
 
-    size_t			Size() const { return _byString.size(); }
-
-    void			Clear()
+    size_t			Size() const { return _size; }
+    size_t			AddressSize() const
+				    { return _byAddress.size(); }
+    bool			Contains( size_t address ) const
 				    {
-					_freeAddresses.clear();
-					_byString.clear();
-					_byAddress.clear();
+					return address < _byAddress.size() &&
+					    _byAddress[ address ].string_p != NULL;
 				    }
 
+    void			Clear();
+
+    static CB_StringTable*	Current()
+				    { return CB_String::_theStringTable_p; }
+
     void			Print( std::ostream& o );
 
 protected:
@@ -254,22 +600,131 @@ private:
     // Implementation functions
     //--------------------------------------------------
 
-    CB_StringTable_t::iterator	Insert( const char* s, size_t l );
-    void			Erase(CB_StringTable_t::iterator itor)
-				    {
-					assert( (*itor).second.refCount == 0 );
-					_freeAddresses.push_back(
-						     (*itor).second.address );
-					_byString.erase( itor );
-				    }
+    CB_Address_t		Insert( const char* s, size_t l );
+    CB_Address_t		InsertEmpty();
+    void			Erase( CB_Address_t address );
+
+    std::vector< CB_Address_t >	SortedAddresses() const;
+
+    static uint32_t		Hash( const char* s, size_t l );
+
+    size_t			FindSlot(
+				    const char*	s,
+				    size_t	l,
+				    uint32_t	hash
+				) const;
+    void			InsertSlot(
+				    CB_Address_t	address,
+				    uint32_t		hash
+				);
+    void			EraseSlot( CB_Address_t address );
+    void			Rehash( size_t nSlots );
+    void			BuildSlots();
 
     //--------------------------------------------------
     // Data Members
     //--------------------------------------------------
-    CB_StringTable_t		_byString;
-    CB_StringItorVector_t	_byAddress;
+    size_t			_size;
+    CB_Address_t		_emptyAddress;
+    bool			_isImmortal;
+
+    std::vector< CB_StringSlot >	_slots;
+    CB_StringDataVector_t	_byAddress;
 
-    std::vector< size_t >	_freeAddresses;
+    std::vector< CB_Address_t >	_freeAddresses;
+
+    CB_StringArena		_arena;
+};
+
+//PAGE
+// ************************************************************************
+// CB_String inline functions
+// ************************************************************************
+
+inline CB_StringData&
+CB_String::Data() const
+{
+    return _theStringTable_p -> _byAddress[ _address ];
+}
+
+inline const char*
+CB_String::c_str() const
+{
+    return Data().string_p;
+}
+
+inline const size_t
+CB_String::size() const
+{
+    return Data().length;
+}
+
+inline const char*
+CB_StringRef::c_str() const
+{
+    return CB_String::_theStringTable_p -> _byAddress[ _address ].string_p;
+}
+
+inline const size_t
+CB_StringRef::size() const
+{
+    return CB_String::_theStringTable_p -> _byAddress[ _address ].length;
+}
+
+//PAGE
+// ************************************************************************
+class CB_StringTableScope
+// ************************************************************************
+//
+// Description:
+// ============
+//
+// Makes a string table the current string table of the calling thread
+// for the lifetime of the scope object, and restores the previous one
+// afterwards. Scopes nest.
+//
+// Every CB_Book owns its string table and enters a scope for it in the
+// member functions that create or destroy strings. Code that copies the
+// strings of a book outside of those must enter the scope itself:
+//
+//	CB_StringTableScope scope( book.Get_stringTable() );
+//
+// Manager functions:
+// ==================
+//	ctor
+//	dtor
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+
+public:
+
+    //--------------------------------------------------
+    // Manager functions: constructors, destructors,
+    // assignment operators, type conversion operators
+    //--------------------------------------------------
+    CB_StringTableScope( CB_StringTable& table ) :
+	_previous_p( CB_String::_theStringTable_p )
+				{ CB_String::_theStringTable_p = &table; }
+    ~CB_StringTableScope()
+				{ CB_String::_theStringTable_p = _previous_p; }
+
+private:
+
+    //--------------------------------------------------
+    // Default copy constructor remains undefined
+    //--------------------------------------------------
+    CB_StringTableScope( const CB_StringTableScope& );
+
+    //--------------------------------------------------
+    // Default assignment operator remains undefined
+    //--------------------------------------------------
+    CB_StringTableScope& operator=( const CB_StringTableScope& );
+
+    //--------------------------------------------------
+    // Data Members
+    //--------------------------------------------------
+    CB_StringTable*		_previous_p;
 };
 
 //PAGE
@@ -278,17 +733,81 @@ private:
 // ************************************************************************
 
 //...Case insensitive CB_String comparison. Used by cookbook.
+//...Compares CB_String and CB_StringRef alike.
 struct LT_CB_String {
-    bool operator() (const CB_String& s1, const CB_String& s2) const
+    typedef void is_transparent;
+
+    bool operator() (CB_StringRef s1, CB_StringRef s2) const
     {
       //return _stricmp( s1.c_str(), s2.c_str() ) < 0;
 	return strcmp( s1.c_str(), s2.c_str() ) < 0;
     }
 };
 
-typedef std::multimap< CB_String, CB_Recipe*, LT_CB_String >	CB_RecipeMap_t;
+//...The recipe maps borrow their keys from the recipes they index:
+//...a recipe must be deleted from the book before its strings change.
+typedef std::multimap< CB_StringRef, CB_Recipe*, LT_CB_String >	CB_RecipeMap_t;
 typedef std::set< CB_String, LT_CB_String >			CB_StringSet_t;
 
+//...Entries of a recipe map, gathered to be sorted and merged into it
+typedef std::vector< std::pair< CB_StringRef, CB_Recipe* > >	CB_RecipeEntries_t;
+
+//...Where a recipe read lazily (CB_Book::READ_LAZY) is encoded in its
+//...file, until its ingredients and directions are decoded
+struct CB_LazyRecipe
+{
+    const char*		begin_p;
+    const char*		end_p;
+    CB_StringTable*	table_p;
+    uint32_t		encoding;
+    CB_Stream*		directionSource_p;
+};
+
+//...A recipe in a book: its slot, its id (0 until it has one), and its
+//...own entries in the name, category and ingredient indices, those of
+//...CB_Book::INDEX_... i next, nEntries[i] of them
+struct CB_RecipeLinks
+{
+    size_t					slot;
+    uint64_t					id;
+    uint32_t					nEntries[3];
+    std::vector< CB_RecipeMap_t::iterator >	entries;
+
+    CB_RecipeLinks() : slot( 0 ), id( 0 ), nEntries() {}
+};
+
+//...What CB_Book::ImportMany() made of one file
+struct CB_ImportReport
+{
+    std::string	fileName;
+    bool	isValid;	//...false if the file could not be read
+    size_t	nRecipes;
+    size_t	nSkipped;	//...Bytes not in a recipe
+    double	scanTime;	//...Seconds, on a thread of its own
+    double	addTime;	//...Seconds, adding its recipes to the book
+
+    CB_ImportReport() : isValid( false ), nRecipes( 0 ), nSkipped( 0 ),
+					scanTime( 0 ), addTime( 0 ) {}
+};
+
+//...An original cookbook file mapped, and where its recipes begin
+struct CB_LegacyScan
+{
+    void*			map_p;
+    size_t			mapSize;
+    std::vector< size_t >	offsets;
+    CB_ImportReport		report;
+
+    CB_LegacyScan() : map_p( NULL ), mapSize( 0 ) {}
+};
+
+//...Called by CB_BookFile::ForEachRecipe() for each recipe
+typedef std::function< void ( CB_Recipe& ) >			CB_RecipeCallback_t;
+
+//...The characters of the string at an address of a file, for strings
+//...read without its string table (CB_Stream::Set_stringSource)
+typedef std::function< bool ( size_t, std::string_view& ) >	CB_StringSource_t;
+
 //PAGE
 // ************************************************************************
 class CB_Ingredient
@@ -405,6 +924,20 @@ class CB_Recipe
 // Implementation Notes:
 // =====================
 //
+// A recipe read by a lazy book (CB_Book::READ_LAZY) has only its
+// single strings decoded. Its ingredients and directions are decoded
+// by Materialize(), which the accessors call, from the input that the
+// book keeps open. Materializing is not thread safe.
+//
+// A recipe of a book knows its slot in the book and its own entries in
+// the indices of the book, so that the book can delete it without a
+// search. A recipe of a book also has an id, which the book gives it
+// when it is added and keeps in the file, and which stays the same for
+// as long as the recipe is in the book. They are kept apart, in its
+// CB_RecipeLinks, as is the encoding of a lazy recipe in its
+// CB_LazyRecipe, so that a recipe is no bigger for either. Copying a
+// recipe copies neither its slot, its entries nor its id.
+//
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
 
@@ -420,21 +953,31 @@ public:
     // Manager functions: constructors, destructors,
     // assignment operators, type conversion operators
     //--------------------------------------------------
-    CB_Recipe() {};
-    ~CB_Recipe() { Clear(); }
+    CB_Recipe() : _lazy_p( NULL ), _links_p( NULL ) {};
+    ~CB_Recipe() { Clear(); delete _links_p; }
 
     //--------------------------------------------------
-    // Default copy constructor
-    // Default assignment operator
+    // Copy constructor, assignment operator: copy the
+    // contents, decoded, but not the slot, the index
+    // entries, the id or the lazy state
     //--------------------------------------------------
-    CB_Recipe( const CB_Recipe& o ) { Copy( o ); }
+    CB_Recipe( const CB_Recipe& o ) : _lazy_p( NULL ), _links_p( NULL )
+							{ Copy( o ); }
     CB_Recipe& operator=( const CB_Recipe& o )
-   				 { Clear(); Copy( o ); return *this; }
+			{
+			    if ( &o != this ) {
+				Clear();
+				Copy( o );
+			    }
+			    return *this;
+			}
 
     //--------------------------------------------------
     // Accessor functions: Get_dataMember; Set_dataMember
     //--------------------------------------------------
 
+    uint64_t				Get_id() const
+				{ return _links_p == NULL ? 0 : _links_p -> id; }
     const CB_String&			Get_name() { return _name; }
     const CB_String&			Get_serves() { return _serves; }
     const CB_String&			Get_cat1() { return _category1; }
@@ -442,14 +985,23 @@ public:
     const CB_String&			Get_cat3() { return _category3; }
     const CB_String&			Get_cat4() { return _category4; }
     const CB_String&			Get_date() { return _date; }
-    const CB_Ingredient_pVector_t&	Get_ingredients() { return _ingredients; }
-    const std::vector< CB_String >&	Get_directions() { return _directions; }
+    const CB_Ingredient_pVector_t&	Get_ingredients()
+    					{ Materialize(); return _ingredients; }
+    const std::vector< CB_String >&	Get_directions()
+    					{ Materialize(); return _directions; }
 
     //--------------------------------------------------
     // Implementation functions
     //--------------------------------------------------
 
     void		Clear();
+    void		Materialize() const
+			{
+			    if ( _lazy_p != NULL ) {
+				Decode();
+			    }
+			}
+    bool		IsMaterialized() const { return _lazy_p == NULL; }
 
     void		Print( std::ostream& );
     void		PrintDirections( std::ostream& );
@@ -467,11 +1019,24 @@ private:
     // Implementation functions
     //--------------------------------------------------
     void		Copy( const CB_Recipe& o );
+    void		Decode() const;
+    CB_RecipeLinks&	Links();
+    void		AddEntry(
+			    size_t			index,
+			    CB_RecipeMap_t::iterator	iEntry
+			);
 
     //--------------------------------------------------
     // Data Members
     //--------------------------------------------------
 
+    //...Of a recipe read lazily, if the ingredients and directions are
+    //...not decoded yet
+    mutable CB_LazyRecipe*	_lazy_p;
+
+    //...Of a recipe in a book
+    CB_RecipeLinks*		_links_p;
+
     CB_String			_name;
     CB_String			_serves;
     CB_String			_category1;
@@ -497,12 +1062,112 @@ class CB_Book
 // Accessor functions:
 // ===================
 //
+//	CB_StringTable&		Get_stringTable()
+//	void			Set_nThreads()	//...For Read, 0 (the
+//						//...default): one per core
+//
 // Implementation functions:
 // =========================
 //
 // Implementation Notes:
 // =====================
 //
+// Each book owns the string table of its strings, so books are
+// independent of each other and can be read on different threads.
+//
+// Read also uses threads of its own, Set_nThreads() of them, for a
+// version 2 file: they decode chunks of the string table, then the
+// recipes at their offsets in the recipe index, then each builds one of
+// the indices. The book is the same as one thread reads. Only this
+// thread reads version 1 files, and recipes with their directions in
+// blocks, unless they are read lazily.
+//
+// Read flags:
+//
+//	READ_ONLY	The strings of the book are immortal (see
+//			CB_StringTable): no reference counting while
+//			loading or using the book. For consumers that
+//			only look at the recipes.
+//	READ_LAZY	Decode the ingredients and directions of a
+//			recipe when they are first used (see CB_Recipe).
+//			The book keeps the file open until Clear(). The
+//			ingredient indices are built on first use too,
+//			unless the file has them.
+//	READ_JOURNAL	Record Add, Delete and Modify in the journal of
+//			the file, until Clear().
+//
+// Journal:
+//
+// Read replays the journal of the file, if there is one, so saving a
+// change to a book read with READ_JOURNAL only appends one record to
+// the journal. Compact(), or a Write to the file of the book, writes
+// all of the book and removes the journal. A journal is ignored if the
+// .cbd file has changed since it was started, and a damaged tail (of
+// an interrupted append) is dropped.
+//
+// Write flags:
+//
+//	WRITE_V1	Write the version 1 format, for old readers.
+//	WRITE_INDEXES	Also write the sorted indices, so that Read does
+//			not have to sort. Version 2 only.
+//	WRITE_IN_PLACE	Overwrite the file itself. By default Write
+//			writes a temporary file, syncs it and renames it
+//			over the file, so the file is always either the
+//			old or the new book, even after a crash.
+//	WRITE_VARINT	Encode the integers of the file in as few bytes
+//			as they need (CB_Stream::ENCODING_VARINT).
+//			Version 2 only.
+//	WRITE_COMPRESSED	Compress the directions into blocks of their
+//			own section, with a dictionary trained on the
+//			book. They are only inflated, a block at a time,
+//			for the recipes that are decoded. Version 2 only.
+//	WRITE_FRONT_CODED	Store the strings by the prefix they share
+//			with the one before them in sorted order, in
+//			blocks that can be searched without reading the
+//			table (CB_BookFile::FindString). Version 2 only.
+//	WRITE_COMPACT	Renumber the strings densely, in the order the
+//			recipes use them, so the file has no free
+//			addresses and Read allocates no more addresses
+//			than there are strings. Compact() always does.
+//
+// Read understands both versions.
+//
+// Delete() removes exactly the entries of a recipe from the indices,
+// which the recipe keeps, and leaves its slot in the book empty, so the
+// other recipes keep theirs. The empty slots are dropped in one pass
+// before the next operation on all the recipes, or once they are half
+// of the book. The number of a recipe, as the journal records it, is
+// its position among the recipes that are left.
+//
+// Add() gives every recipe the next id of the book, which is never
+// given again, and FindRecipe( id ) finds a recipe by its id in
+// constant time. Version 2 files keep the ids of the recipes; the
+// recipes of a version 1 file, or of a file without them, are given
+// the ids 1 to n in order when it is read. The journal needs no ids:
+// replaying it adds the recipes again in the same order.
+//
+// AddMany() adds many recipes at once, and indexes them together: it
+// sorts the entries of each index, then merges them into the index in
+// order, each next to the one before. Add() is AddMany() of one
+// recipe, and a single thread indexes a book that it reads, or the
+// recipes of an imported file, the same way.
+//
+// ImportMany() imports original cookbook files on Set_nThreads()
+// threads, which scan the files for their recipes while this thread
+// adds the recipes to the book, file by file. ImportDirectory() imports
+// all of the files of a directory.
+//
+// Freeze() writes the book as a frozen book image (see CB_FrozenBook),
+// with all of its indices, for readers that never change it.
+//
+// MakeBackup() keeps the newest nBackups copies of a file, named
+// backup_<name>.<date>-<time> next to it. A copy shares the data of the
+// file where it can: a clone where the file system can, or else a hard
+// link. A hard link stays the old book because Write replaces the file
+// rather than writing into it; WRITE_IN_PLACE would change the backup
+// too. Otherwise the kernel copies the file (copy_file_range(), or
+// sendfile()), without passing the data through the program.
+//
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
 
@@ -510,12 +1175,32 @@ public:
 
     friend class CB_Stream;
 
+    //...Read flags
+    enum {
+	READ_ONLY	= 0x01,
+	READ_LAZY	= 0x02,
+	READ_JOURNAL	= 0x04
+    };
+
+    //...Write flags
+    enum {
+	WRITE_V1	= 0x01,
+	WRITE_INDEXES	= 0x02,
+	WRITE_IN_PLACE	= 0x04,
+	WRITE_COMPACT	= 0x08,
+	WRITE_VARINT	= 0x10,
+	WRITE_FRONT_CODED	= 0x20,
+	WRITE_COMPRESSED	= 0x40
+    };
+
     //--------------------------------------------------
     // Manager functions: constructors, destructors,
     // assignment operators, type conversion operators
     //--------------------------------------------------
-    CB_Book() : _isDirty( false ) {};
-    ~CB_Book() { Clear(); };
+    CB_Book() : _isDirty( false ), _isIngredientIndexPending( false ),
+		_isJournaling( false ), _fingerprint( 0 ), _nThreads( 0 ),
+		_nDeleted( 0 ), _nextId( 1 ) {};
+    ~CB_Book();
 
     //--------------------------------------------------
     // Accessor functions: Get_dataMember; Set_dataMember
@@ -524,44 +1209,77 @@ public:
     void			Clr_isDirty() { _isDirty = false; }
     bool			Get_isDirty() { return _isDirty; }
 
+    CB_StringTable&		Get_stringTable() { return _stringTable; }
+
+    void			Set_nThreads( unsigned int v ) { _nThreads = v; }
+    unsigned int		Get_nThreads() const { return _nThreads; }
+
     CB_RecipeMap_t&		Get_sortedByName()
 					{ return _sortedByName; }
     CB_RecipeMap_t&		Get_sortedByCategory()
 					{ return _sortedByCategory; }
     CB_RecipeMap_t&		Get_sortedByIngredient()
-					{ return _sortedByIngredient; }
+			{ IndexIngredients(); return _sortedByIngredient; }
 
     CB_StringSet_t&		Get_categoryNames()
 						{ return _categoryNames; }
     CB_StringSet_t&		Get_quantityNames()
-						{ return _quantityNames; }
+			{ IndexIngredients(); return _quantityNames; }
     CB_StringSet_t&		Get_measurementNames()
-						{ return _measurementNames; }
+			{ IndexIngredients(); return _measurementNames; }
     CB_StringSet_t&		Get_preparationNames()
-						{ return _preparationNames; }
+			{ IndexIngredients(); return _preparationNames; }
     CB_StringSet_t&		Get_ingredientNames()
-						{ return _ingredientNames; }
+			{ IndexIngredients(); return _ingredientNames; }
 
     //--------------------------------------------------
     // Implementation functions
     //--------------------------------------------------
 
-    void		Read( const char* fileName );
-    void		Write( char* fileName );
-    void		MakeBackup( char* fileName );
+    bool		Read( const char* fileName, unsigned int flags = 0 );
+    size_t		Write( char* fileName, unsigned int flags = 0 );
+    size_t		Compact( unsigned int flags = 0 );
+    size_t		Freeze( const char* fileName );
+    bool		MakeBackup(
+			    const char*	fileName,
+			    size_t	nBackups = 1
+			);
 
     void		Clear();
 
     void		Add( CB_Recipe* );	//...After indexing
+    void		AddMany(		//...After indexing
+			    const CB_Recipe_pVector_t&	recipes
+			);
+    CB_Recipe*		FindRecipe( uint64_t id ) const;
     void		Delete( CB_Recipe* );	//...After indexing
+    void		Modify(			//...After indexing
+			    CB_Recipe*		recipe_p,
+			    const CB_Recipe&	recipe
+			);
+
+    static std::string	JournalName( const char* fileName );
+    static bool		CopyFileData( int inFd, int outFd );
 
     void		Print( std::ostream& );
     void		PrintSortedNames( std::ostream& );
     void		PrintSortedCategories( std::ostream& );
     void		PrintSortedIngredients( std::ostream& );
 
-    void		Import( char* fileName );
+    size_t		Import( const char* fileName );
     			// Import original cookbook data
+    size_t		ImportMany(
+			    const std::vector< std::string >&	fileNames,
+			    std::vector< CB_ImportReport >&	reports
+			);
+    size_t		ImportDirectory(
+			    const char*				dirName,
+			    std::vector< CB_ImportReport >&	reports
+			);
+    static void		PrintImportReports(
+			    std::ostream&				o,
+			    const std::vector< CB_ImportReport >&	reports
+			);
 
     CB_Ingredient*	NewIngredient(
 			    std::vector< CB_String >::iterator&	first,
@@ -588,20 +1306,138 @@ private:
     // Implementation functions
     //--------------------------------------------------
 
-    void		Index();
-    void		IndexRecipe( CB_Recipe* recipe_p );
-    void		DeleteFromMap(
-			    CB_Recipe*		recipe_p,
-			    CB_RecipeMap_t&	theMap
+    unsigned int	NThreads() const;
+    bool		ReadRecipeOffsets(
+			    CB_Stream&			stream,
+			    std::vector< size_t >&	offsets
 			);
 
+    void		Index( unsigned int nThreads = 1 );
+    void		IndexMany(
+			    CB_Recipe_pVector_t::const_iterator	first,
+			    CB_Recipe_pVector_t::const_iterator	last
+			);
+    static void		MergeEntries(
+			    CB_RecipeMap_t&		map,
+			    CB_RecipeEntries_t&		entries,
+			    size_t			index
+			);
+    static void		MergeNames(
+			    CB_StringSet_t&		set,
+			    std::vector< CB_StringRef >&	names
+			);
+    void		IndexName( CB_Recipe* recipe_p );
+    void		IndexCategories( CB_Recipe* recipe_p );
+    void		IndexRecipeIngredients( CB_Recipe* recipe_p );
+    void		LinkEntries( size_t index );
+    void		IndexIngredients()
+			{
+			    if ( _isIngredientIndexPending ) {
+				IndexAllIngredients();
+			    }
+			}
+    void		IndexAllIngredients();
+    void		CountReferences(
+			    std::vector< uint32_t >&	refCounts,
+			    bool			isCountingDirections
+			);
+    void		CompactAddresses(
+			    std::vector< CB_Address_t >&	addressMap,
+			    bool				isCountingDirections
+			);
+    void		TrainDictionary( std::string& dictionary );
+
+    static void		ScanLegacyFile(
+			    const char*		fileName,
+			    CB_LegacyScan&	scan
+			);
+    void		AddLegacyRecipes( CB_LegacyScan& scan );
+    static const unsigned char*	SkipLegacyPadding(
+				    const unsigned char*	p,
+				    const unsigned char*	end_p
+				);
+    static bool		ScanLegacyRecipe(
+			    const unsigned char*&		p,
+			    const unsigned char*		end_p,
+			    std::vector< std::string_view >	blocks[3]
+			);
+    CB_Recipe*		NewLegacyRecipe(
+			    const std::vector< std::string_view >	blocks[3]
+			);
+
+    void		WriteRecipes(
+			    CB_Stream&				stream,
+			    std::vector< size_t >&		offsets
+			);
+    void		WriteRecipeIndex(
+			    CB_Stream&				stream,
+			    const std::vector< size_t >&	offsets
+			);
+    void		WriteIndexes(
+			    CB_Stream&				stream,
+			    const std::vector< uint32_t >&	refCounts
+			);
+    bool		ReadIndexes( CB_Stream& stream );
+    void		WriteRecipeIds( CB_Stream& stream );
+    bool		ReadRecipeIds( CB_Stream& stream );
+    void		NumberRecipeIds();
+
+    void		Journal(
+			    size_t			type,
+			    size_t			recipeNo,
+			    const CB_Recipe_pVector_t&	recipes
+			);
+    void		ReplayJournal( bool isRepairing );
+
+    //...Journal record types
+    enum {
+	JOURNAL_ADD	= 1,
+	JOURNAL_DELETE	= 2,
+	JOURNAL_MODIFY	= 3
+    };
+    //...Indices of the entries of a recipe (CB_RecipeLinks::entries)
+    enum {
+	INDEX_NAME	= 0,
+	INDEX_CATEGORY	= 1,
+	INDEX_INGREDIENT	= 2
+    };
+    void		Unindex( CB_Recipe* recipe_p );
+
+    void		CompactRecipes();
+    void		CountLiveSlot( size_t slot, int delta );
+    size_t		LiveBefore( size_t slot ) const;
+    size_t		LiveSlot( size_t recipeNo ) const;
+
     //--------------------------------------------------
     // Data Members
     //--------------------------------------------------
 
+    //...First, so that it outlives all the strings of the book
+    CB_StringTable		_stringTable;
+
     bool			_isDirty;
+    bool			_isIngredientIndexPending;
+
+    //...The input of a lazy book
+    std::unique_ptr< CB_Stream >	_source_p;
+
+    //...The file read, and its journal
+    std::string			_fileName;
+    std::string			_journalName;
+    bool			_isJournaling;
+    uint32_t			_fingerprint;	//...Of the file
+
+    unsigned int		_nThreads;	//...0: one per core
 
+    //...NULL in the slot of a recipe deleted since CompactRecipes(), and
+    //...a Fenwick tree of the live slots, for the recipe numbers
     CB_Recipe_pVector_t		_recipes;
+    size_t			_nDeleted;
+    std::vector< uint32_t >	_liveCounts;
+
+    //...The recipes by id, and the id of the next recipe added
+    std::unordered_map< uint64_t, CB_Recipe* >	_byId;
+    uint64_t			_nextId;
 
     CB_RecipeMap_t		_sortedByName;
     CB_RecipeMap_t		_sortedByCategory;
@@ -614,6 +1450,302 @@ private:
     CB_StringSet_t		_ingredientNames;
 };
 
+//PAGE
+// ************************************************************************
+class CB_BookFile
+// ************************************************************************
+//
+// Description:
+// ============
+//
+// A cookbook file opened for access to single recipes, without
+// building a CB_Book. Open() reads the recipe index and the names of
+// the recipes, and notes where each string of the file is; a recipe is
+// read when it is asked for, with one seek into the file, and only its
+// own strings are read into the string table. Files without a recipe
+// index get one from a pass over the single strings of their recipes.
+//
+// Accessor functions:
+// ===================
+//
+//	CB_StringTable&		Get_stringTable()
+//
+// Implementation functions:
+// =========================
+//
+//	bool		Open( fileName )
+//	size_t		Size()		//...Number of recipes
+//	CB_Recipe*	GetRecipe( n )	//...NULL if there is no such recipe
+//	CB_Recipe*	FindRecipe( name )	//...NULL if there is none
+//	CB_Address_t	FindString( s )	//...In the file; CB_NO_ADDRESS if
+//					//...there is none
+//	bool		ForEachRecipe( callback )	//...In name order
+//
+// Implementation Notes:
+// =====================
+//
+// The recipes returned belong to the caller, and their strings to the
+// string table of this object: use them within a CB_StringTableScope
+// of it, and delete them before closing it.
+//
+// The memory used is bounded by the recipes and the strings that the
+// caller keeps, not by the file: the string table holds only theirs,
+// and it is cleared when a recipe is read while the caller keeps none.
+// Besides, Open() keeps the recipe index, the names, and the address
+// and offset of each string of the file (CB_BookFile::_stringOffsets),
+// so that a string is found by a binary search and read from the file
+// where it lies. The file itself stays mapped, and only its pages in
+// use stay in memory.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+
+public:
+
+    //--------------------------------------------------
+    // Manager functions: constructors, destructors,
+    // assignment operators, type conversion operators
+    //--------------------------------------------------
+    CB_BookFile() : _restart( 1 ) {};
+    ~CB_BookFile();
+
+    //--------------------------------------------------
+    // Accessor functions: Get_dataMember; Set_dataMember
+    //--------------------------------------------------
+    CB_StringTable&		Get_stringTable() { return _stringTable; }
+
+    //--------------------------------------------------
+    // Implementation functions
+    //--------------------------------------------------
+
+    bool		Open( const char* fileName );
+    void		Close();
+
+    size_t		Size() const { return _offsets.size(); }
+    CB_Recipe*		GetRecipe( size_t n );
+    CB_Recipe*		FindRecipe( const char* name );
+    CB_Address_t	FindString( const char* s );
+    bool		ForEachRecipe( const CB_RecipeCallback_t& callback );
+
+protected:
+
+private:
+
+    //--------------------------------------------------
+    // Default copy constructor remains undefined
+    //--------------------------------------------------
+    CB_BookFile( const CB_BookFile& );
+
+    //--------------------------------------------------
+    // Default assignment operator remains undefined
+    //--------------------------------------------------
+    CB_BookFile& operator=( const CB_BookFile& );
+
+    //--------------------------------------------------
+    // Implementation functions
+    //--------------------------------------------------
+
+    bool		IndexStrings( CB_Stream& stream );
+    bool		GetString( size_t address, std::string_view& text );
+    bool		AddName( size_t address );
+    bool		ScanRecipes( CB_Stream& stream );
+
+    //--------------------------------------------------
+    // Data Members
+    //--------------------------------------------------
+
+    //...First, so that they outlive all the strings of the file: the
+    //...strings of the recipes read, and the names of all recipes
+    CB_StringTable			_stringTable;
+    CB_StringTable			_nameTable;
+
+    std::unique_ptr< CB_Stream >	_stream_p;
+
+    //...The string table of the file: its own input, and the address
+    //...and offset of each string, or of its block if front-coded, by
+    //...address
+    std::unique_ptr< CB_Stream >	_strings_p;
+    std::vector< std::pair< CB_Address_t, uint32_t > >
+					_stringOffsets;
+    size_t				_restart;	//...Strings a block
+    std::string				_text;	//...Of a front-coded string
+    CB_StringSource_t			_stringSource;
+
+    std::vector< size_t >		_offsets;	//...In RECIPES
+    std::vector< CB_Address_t >		_names;		//...In _nameTable
+    std::vector< size_t >		_byName;	//...Recipe numbers
+};
+
+//PAGE
+// ************************************************************************
+class CB_FrozenBook
+// ************************************************************************
+//
+// Description:
+// ============
+//
+// A frozen book image (.cbf, written by CB_Book::Freeze), mapped into
+// memory and queried where it lies: Open() only checks the header and
+// the bounds of the tables. Nothing is decoded or allocated, and the
+// pages of the image are shared by all the processes that map it.
+//
+// Accessor functions:
+// ===================
+//
+//	size_t		Size()		//...Number of recipes
+//	const char*	String( s )	//...The characters of a string
+//
+// Implementation functions:
+// =========================
+//
+//	bool		Open( fileName )
+//	bool		Verify()	//...Checksum of all of the tables
+//	GetRecipe( n )		//...NULL if there is no such recipe
+//	FindRecipe( name )	//...The first of the name, or NULL
+//	GetIngredients( recipe, n ), GetDirections( recipe, n )
+//	SortedByName( n ), SortedByCategory( n ), SortedByIngredient( n )
+//	FindCategory( key, n ), FindIngredient( key, n )	//...The
+//				//...entries of the key, n of them
+//	CategoryNames( n ), QuantityNames( n ), MeasurementNames( n ),
+//	PreparationNames( n ), IngredientNames( n )
+//
+// Implementation Notes:
+// =====================
+//
+// The image is never written, so any number of threads can query it.
+// The records returned point into the image: they are valid until
+// Close(). A record that refers outside its table (in a damaged image)
+// reads as empty, never beyond the image.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+{
+
+public:
+
+    //...Tables of the image
+    enum {
+	TABLE_STRINGS	= 0,
+	TABLE_RECIPES	= 1,
+	TABLE_INGREDIENTS	= 2,
+	TABLE_DIRECTIONS	= 3,
+	TABLE_BY_NAME	= 4,
+	TABLE_BY_CATEGORY	= 5,
+	TABLE_BY_INGREDIENT	= 6,
+	TABLE_CATEGORY_NAMES	= 7,
+	TABLE_QUANTITY_NAMES	= 8,
+	TABLE_MEASUREMENT_NAMES	= 9,
+	TABLE_PREPARATION_NAMES	= 10,
+	TABLE_INGREDIENT_NAMES	= 11
+    };
+
+    //--------------------------------------------------
+    // Manager functions: constructors, destructors,
+    // assignment operators, type conversion operators
+    //--------------------------------------------------
+    CB_FrozenBook();
+    ~CB_FrozenBook();
+
+    //--------------------------------------------------
+    // Accessor functions: Get_dataMember; Set_dataMember
+    //--------------------------------------------------
+    size_t		Size() const { return _counts[ TABLE_RECIPES ]; }
+    const char*		String( const CB_FrozenString& s ) const;
+
+    //--------------------------------------------------
+    // Implementation functions
+    //--------------------------------------------------
+
+    bool		Open( const char* fileName );
+    void		Close();
+    bool		Verify() const;
+
+    const CB_FrozenRecipe*	GetRecipe( size_t n ) const;
+    const CB_FrozenRecipe*	FindRecipe( const char* name ) const;
+    const CB_FrozenIngredient*	GetIngredients(
+				    const CB_FrozenRecipe&	recipe,
+				    size_t&			n
+				) const;
+    const CB_FrozenString*	GetDirections(
+				    const CB_FrozenRecipe&	recipe,
+				    size_t&			n
+				) const;
+
+    const uint32_t*	SortedByName( size_t& n ) const
+			{ return Table< uint32_t >( TABLE_BY_NAME, n ); }
+    const CB_FrozenEntry*	SortedByCategory( size_t& n ) const
+		{ return Table< CB_FrozenEntry >( TABLE_BY_CATEGORY, n ); }
+    const CB_FrozenEntry*	SortedByIngredient( size_t& n ) const
+		{ return Table< CB_FrozenEntry >( TABLE_BY_INGREDIENT, n ); }
+    const CB_FrozenEntry*	FindCategory( const char* key, size_t& n ) const
+			{ return FindEntries( TABLE_BY_CATEGORY, key, n ); }
+    const CB_FrozenEntry*	FindIngredient( const char* key, size_t& n ) const
+			{ return FindEntries( TABLE_BY_INGREDIENT, key, n ); }
+
+    const CB_FrozenString*	CategoryNames( size_t& n ) const
+	{ return Table< CB_FrozenString >( TABLE_CATEGORY_NAMES, n ); }
+    const CB_FrozenString*	QuantityNames( size_t& n ) const
+	{ return Table< CB_FrozenString >( TABLE_QUANTITY_NAMES, n ); }
+    const CB_FrozenString*	MeasurementNames( size_t& n ) const
+	{ return Table< CB_FrozenString >( TABLE_MEASUREMENT_NAMES, n ); }
+    const CB_FrozenString*	PreparationNames( size_t& n ) const
+	{ return Table< CB_FrozenString >( TABLE_PREPARATION_NAMES, n ); }
+    const CB_FrozenString*	IngredientNames( size_t& n ) const
+	{ return Table< CB_FrozenString >( TABLE_INGREDIENT_NAMES, n ); }
+
+    void		Print( std::ostream& ) const;
+    void		PrintSortedNames( std::ostream& ) const;
+    void		PrintSortedCategories( std::ostream& ) const;
+    void		PrintSortedIngredients( std::ostream& ) const;
+
+    static size_t	ElementSize( size_t table );
+
+protected:
+
+private:
+
+    //--------------------------------------------------
+    // Default copy constructor remains undefined
+    //--------------------------------------------------
+    CB_FrozenBook( const CB_FrozenBook& );
+
+    //--------------------------------------------------
+    // Default assignment operator remains undefined
+    //--------------------------------------------------
+    CB_FrozenBook& operator=( const CB_FrozenBook& );
+
+    //--------------------------------------------------
+    // Implementation functions
+    //--------------------------------------------------
+
+    template< class T >
+    const T*		Table( size_t table, size_t& n ) const
+			{
+			    n = _counts[ table ];
+			    return (const T*) _tables_p[ table ];
+			}
+    const CB_FrozenEntry*	FindEntries(
+				    size_t	table,
+				    const char*	key,
+				    size_t&	n
+				) const;
+    const char*		RecipeName( size_t n ) const;
+    void		PrintRecipe(
+			    std::ostream&		o,
+			    const CB_FrozenRecipe&	recipe
+			) const;
+    void		PrintEntries( std::ostream& o, size_t table ) const;
+
+    //--------------------------------------------------
+    // Data Members
+    //--------------------------------------------------
+
+    void*		_map_p;
+    size_t		_mapSize;
+
+    const char*		_tables_p[ CB_FROZEN_TABLES ];
+    size_t		_counts[ CB_FROZEN_TABLES ];
+};
+
 //PAGE
 // ************************************************************************
 class CB_Stream
@@ -628,12 +1760,63 @@ class CB_Stream
 // Accessor functions:
 // ===================
 //
+//	bool	Good()	//...false once input was missing or inconsistent,
+//			//...or output could not be written
+//	size_t	Get_bytesWritten()
+//	size_t	Remaining()	//...Input left in the current section
+//	void	Set_isLazy()	//...Read recipes as for CB_Book::READ_LAZY
+//	void	Set_isLiteral()	//...Strings as characters, not addresses
+//	void	Set_addressMap()	//...New address of each address, for
+//				//...the strings and references written
+//	void	Set_directionSource()	//...Input with the DIRECTIONS
+//				//...section of the recipes read
+//	void	Set_stringSource()	//...Characters of each address, for
+//				//...strings read into a table of their own
+//
 // Implementation functions:
 // =========================
 //
+//	bool	Flush()	//...Write out the buffered output
+//	bool	Commit()	//...Flush, sync, and for mode "sb" rename
+//
 // Implementation Notes:
 // =====================
 //
+// An input stream maps the whole file into memory, or reads it into
+// a buffer in one go where it cannot be mapped. If the file cannot be
+// opened, the input is empty and Good() is false. Integers are decoded
+// straight from those bytes, and strings are entered into the string
+// table from pointers into them. Reading past the end of the input
+// yields zeros and clears Good().
+//
+// An output stream serializes into a growable memory buffer, which is
+// written to the file in one go by Flush() or the destructor. If the
+// file cannot be opened, Good() is false and Flush() and Commit() fail,
+// for the caller to report it.
+//
+// Mode "sb" (safe) writes a temporary file next to the file, which
+// Commit() syncs and renames over the file. Without a Commit(), the
+// temporary file is removed and the file is left as it was.
+//
+// Version 2 files: the writer brackets the data of each section with
+// BeginSection() and EndSection(), and EndContainer() adds the header
+// and the directory. The reader checks the container in ReadHeader(),
+// then SelectSection() limits the input to one section. The encoding
+// of a section applies while it is being written or read: with
+// ENCODING_VARINT, the integers (addresses, lengths, counts) are
+// unsigned LEB128, so most take one or two bytes and none is limited
+// to 32 bits.
+// ENCODING_FRONT_CODED only applies to a string table, which is then
+// kept in sorted order, each string stored as its prefix shared with
+// the string before and the rest of it.
+//
+// ENCODING_DIRECTION_BLOCKS applies to recipes: their directions are
+// written as characters into blocks of text, and the recipe only holds
+// the block and the offset of its directions. PutDirections() deflates
+// the blocks into the DIRECTIONS section. An input stream inflates a
+// block when a recipe needs it, and keeps the last one; the recipes of
+// a memory stream take their directions from Set_directionSource().
+//
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 {
 
@@ -643,18 +1826,32 @@ public:
     // assignment operators, type conversion operators
     //--------------------------------------------------
     CB_Stream(const char* fileName, const char* mode);
+    CB_Stream(const char* begin_p, size_t size, uint32_t encoding = 0);
     ~CB_Stream();
 
     //--------------------------------------------------
     // Accessor functions: Get_dataMember; Set_dataMember
     //--------------------------------------------------
+    bool		Good() const { return _isGood; }
+    size_t		Get_bytesWritten() const { return _bytesWritten; }
+    uint32_t		Get_version() const { return _version; }
+    uint32_t		Get_encoding() const { return _encoding; }
+    size_t		Remaining() const { return _end_p - _next_p; }
+    void		Set_isLazy( bool v = true ) { _isLazy = v; }
+    void		Set_isLiteral( bool v = true ) { _isLiteral = v; }
+    void		Set_addressMap( const std::vector< CB_Address_t >* v )
+							{ _addressMap_p = v; }
+    void		Set_directionSource( CB_Stream* v )
+							{ _directionSource_p = v; }
+    void		Set_stringSource( const CB_StringSource_t* v )
+							{ _stringSource_p = v; }
 
     //--------------------------------------------------
     // Implementation functions
     //--------------------------------------------------
 
     //...Out
-    CB_Stream&		operator << ( const CB_String );
+    CB_Stream&		operator << ( CB_StringRef );
     CB_Stream&		operator << ( const CB_StringTable& );
     CB_Stream&		operator << ( const CB_Book& );
     CB_Stream&		operator << ( const CB_Recipe& );
@@ -662,23 +1859,147 @@ public:
 
     CB_Stream&		operator << ( const size_t& v )
 			    {
+				if ( _encoding & ENCODING_VARINT ) {
+				    PutVarint( v );
+				    return *this;
+				}
                               int32_t val = v;
-				fwrite( &val, sizeof(int32_t), 1, _file );
+				PutBytes( &val, sizeof(int32_t) );
 				return *this;
 			    }
 
+    void		PutUint64( uint64_t v )
+			    {
+				if ( _encoding & ENCODING_VARINT ) {
+				    PutVarint( v );
+				    return;
+				}
+				PutBytes( &v, sizeof(uint64_t) );
+			    }
+    uint64_t		GetUint64()
+			    {
+				if ( _encoding & ENCODING_VARINT ) {
+				    return GetVarint();
+				}
+				uint64_t v = 0;
+				const char* p = GetBytes( sizeof(uint64_t) );
+				if ( p != NULL ) {
+				    memcpy( &v, p, sizeof(uint64_t) );
+				}
+				return v;
+			    }
+
+    void		PutData( const void* p, size_t n )
+			    {
+				PutBytes( p, n );
+			    }
+    const char*		GetData( size_t n )
+			    {
+				return GetBytes( n );
+			    }
+    void		PutStringTable(
+			    const CB_StringTable&		table,
+			    const std::vector< uint32_t >*	refCounts_p
+			);
+    bool		PutDirections( const std::string& dictionary );
+
+    bool		Flush();
+    bool		Commit();
+
+    void		BeginContainer();
+    void		BeginSection( uint32_t id, uint32_t encoding = 0 );
+    void		EndSection();
+    void		EndContainer();
+
+    void		PutJournalHeader( uint32_t fingerprint );
+    void		BeginRecord();
+    void		EndRecord();
+
     //...In
+    bool		ReadHeader(
+			    bool		isVerifyingSections = true,
+			    unsigned int	nThreads = 1
+			);
+    bool		VerifySection( uint32_t id );
+    CB_Stream*		NewSectionInput() const;
+    bool		SelectSection( uint32_t id );
+    bool		Seek( size_t offset );
+    size_t		Tell() const;
+
+    bool		GetJournalHeader( uint32_t& fingerprint );
+    bool		NextRecord();
+    size_t		RecordEnd() const { return _recordEnd_p - _begin_p; }
+
+    uint32_t		Fingerprint() const;
+
     CB_Stream&		operator >> ( CB_String& );
     CB_Stream&		operator >> ( CB_StringTable& );
     CB_Stream&		operator >> ( CB_Book& );
     CB_Stream&		operator >> ( CB_Recipe& );
     CB_Stream&		operator >> ( CB_Ingredient& );
+    bool		GetStringTable(
+			    CB_StringTable&	table,
+			    unsigned int	nThreads
+			);
+    bool		GetRecipes(
+			    CB_Book&				book,
+			    const std::vector< size_t >&	offsets,
+			    unsigned int			nThreads
+			);
+    bool		FindString(
+			    const char*	s,
+			    size_t	l,
+			    size_t&	address
+			);
+    void		GetRecipeBody(
+			    CB_Recipe&	recipe,
+			    size_t	nIngredients,
+			    size_t	nDirections
+			);
+
+    static uint32_t	Checksum(
+			    const void*	p,
+			    size_t	n,
+			    uint32_t	crc = 0
+			);
+
+    //...Section ids
+    enum {
+	SECTION_STRINGS	= 1,
+	SECTION_RECIPES	= 2,
+	SECTION_INDEXES	= 3,
+	SECTION_RECIPE_INDEX	= 4,
+	SECTION_DIRECTIONS	= 5,
+	SECTION_RECIPE_IDS	= 6
+    };
+
+    //...Section encodings, a set of bits
+    enum {
+	ENCODING_VARINT	= 0x01,		//...Integers as LEB128
+	ENCODING_FRONT_CODED	= 0x02,	//...Strings by shared prefix
+	ENCODING_DIRECTION_BLOCKS	= 0x04,	//...In SECTION_DIRECTIONS
+	ENCODING_ALL	= 0x07
+    };
+
+    //...The least bytes an integer takes
+    size_t		MinIntSize() const
+			    {
+				return (_encoding & ENCODING_VARINT) ?
+						1 : sizeof(int32_t);
+			    }
 
     CB_Stream&		operator >> ( size_t& v )
 			    {
-                              int32_t val;
-				fread( &val, sizeof(int32_t), 1, _file );
-                                v = val;
+				if ( _encoding & ENCODING_VARINT ) {
+				    v = GetVarint();
+				    return *this;
+				}
+				int32_t val = 0;
+				const char* p = GetBytes( sizeof(int32_t) );
+				if ( p != NULL ) {
+				    memcpy( &val, p, sizeof(int32_t) );
+				}
+				v = val;
 				return *this;
 			    }
 protected:
@@ -695,11 +2016,137 @@ private:
     //--------------------------------------------------
     CB_Stream& operator=( const CB_Stream& );
 
+    //--------------------------------------------------
+    // Implementation functions
+    //--------------------------------------------------
+    void		OpenInput( const char* fileName );
+    void		OpenOutput( const char* fileName, const char* mode );
+
+    void		GetStrings(
+			    CB_StringTable&	table,
+			    CB_StringArena&	arena,
+			    size_t		first,
+			    size_t		nStrings,
+			    size_t		restart,
+			    CB_Address_t&	emptyAddress
+			);
+
+    void		PutDirectionBlock(
+			    const std::vector< CB_String >&	directions
+			);
+    bool		LoadDirections();
+    bool		GetDirections(
+			    std::vector< CB_String >&	directions,
+			    size_t			nDirections,
+			    size_t			block,
+			    size_t			offset
+			);
+    static bool		Deflate(
+			    const std::string&	text,
+			    const std::string&	dictionary,
+			    std::string&	data
+			);
+    bool		Inflate( const CB_DirectionBlock& block );
+
+    void		SyncDirectory();
+
+    void		PutVarint( uint64_t v )
+			    {
+				char bytes[ 10 ];
+				size_t n = 0;
+				while ( v >= 0x80 ) {
+				    bytes[ n++ ] = (char) (v | 0x80);
+				    v >>= 7;
+				}
+				bytes[ n++ ] = (char) v;
+				PutBytes( bytes, n );
+			    }
+
+    uint64_t		GetVarint()
+			    {
+				uint64_t v = 0;
+				int shift;
+				for ( shift = 0 ; shift < 64 ; shift += 7 ) {
+				    if ( _next_p == _end_p ) {
+					break;
+				    }
+				    unsigned char c = *(_next_p++);
+				    v |= (uint64_t) (c & 0x7f) << shift;
+				    if ( (c & 0x80) == 0 ) {
+					return v;
+				    }
+				}
+				_isGood = false;
+				return 0;
+			    }
+
+    void		PutBytes( const void* p, size_t n )
+			    {
+				const char* c_p = (const char*) p;
+				_buffer.insert( _buffer.end(), c_p, c_p + n );
+			    }
+
+    //...The next n input bytes, or NULL if there are not as many
+    const char*		GetBytes( size_t n )
+			    {
+				if ( (size_t) (_end_p - _next_p) < n ) {
+				    _next_p = _end_p;
+				    _isGood = false;
+				    return NULL;
+				}
+				const char* p = _next_p;
+				_next_p += n;
+				return p;
+			    }
+
     //--------------------------------------------------
     // Data Members
     //--------------------------------------------------
 
-    FILE*	_file;
+    int			_fd;		//...Output
+    std::string		_fileName;
+    std::string		_tempName;	//...Of mode "sb" until Commit()
+    bool		_isNewFile;	//...Created by mode "ab"
+    size_t		_bytesWritten;
+
+    std::vector< char >	_buffer;	//...Output, or input not mapped
+
+    void*		_map_p;		//...Input
+    size_t		_mapSize;
+    const char*		_begin_p;	//...All of the input
+    const char*		_fileEnd_p;
+    const char*		_sectionBegin_p;	//...The current section
+    const char*		_next_p;
+    const char*		_end_p;
+
+    uint32_t		_version;
+    uint32_t		_encoding;	//...Of the current section
+    std::vector< CB_SectionEntry >
+			_sections;
+
+    const char*		_recordEnd_p;	//...Of the last journal record
+    size_t		_recordOffset;
+
+    const std::vector< CB_Address_t >*	_addressMap_p;
+    const CB_StringSource_t*		_stringSource_p;
+
+    //...The DIRECTIONS section: the text of its blocks on output; on
+    //...input, where they are, and the last one inflated
+    CB_Stream*		_directionSource_p;
+    std::vector< std::string >
+			_directionText;
+    std::vector< CB_DirectionBlock >
+			_directionBlocks;
+    const char*		_dictionary_p;
+    size_t		_dictionarySize;
+    const char*		_directionData_p;	//...NULL until loaded
+    uint32_t		_directionEncoding;
+    size_t		_directionBlockNo;	//...Of _directionBlock
+    std::string		_directionBlock;
+
+    bool		_isLazy;
+    bool		_isLiteral;
+    bool		_isGood;
 };
 
 //PAGE
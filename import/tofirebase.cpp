@@ -119,18 +119,20 @@ int main(int argc, char** argv) {
   std::map<std::string, int> urlCounts;
   std::ostringstream titleStream;
 
-  CB_Book* book = new CB_Book;
-  book->Read(argv[1]);
+  // One recipe at a time, in name order.
+  CB_BookFile bookFile;
+  if (!bookFile.Open(argv[1]))
+    exit(1);
+  CB_StringTableScope scope(bookFile.Get_stringTable());
   Value root(Json::objectValue);
-  const CB_RecipeMap_t& recipes = book->Get_sortedByName();
   Value& recipesMeta = root["recipesMeta"] = emptyObject;
   Value& recipesDetails = root["recipesDetails"] = emptyObject;
   Value& recipeUrls = root["recipeUrls"] = emptyObject;
   Value& ingredientNames = root["ingredientNames"] = emptyObject;
   Value& ingredientRecipes = root["ingredientRecipes"] = emptyObject;
 
-  for (auto& elem : recipes) {
-    CB_Recipe* const recipe = elem.second;
+  const bool allRead = bookFile.ForEachRecipe([&](CB_Recipe& r) {
+    CB_Recipe* const recipe = &r;
     const std::string recipeId = next_push_id();
     Value& recipeMeta = recipesMeta[recipeId] = emptyObject;
     Value& recipeDetails = recipesDetails[recipeId] = emptyObject;
@@ -195,6 +197,10 @@ int main(int argc, char** argv) {
       directions += "\n";
     }
     recipeDetails["directions"] = directions;
+  });
+  if (!allRead) {
+    std::cerr << argv[1] << ": cannot read all of the recipes\n";
+    exit(1);
   }
   Json::StyledStreamWriter("  ").write(std::cout, root);
 };
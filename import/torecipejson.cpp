@@ -8,7 +8,6 @@
 #include <fmt/core.h>
 #include <memory>
 #include <random>
-#include <ranges>
 #include <regex>
 
 using Json::Value;
@@ -94,19 +93,16 @@ int main(int argc, char **argv) {
   const Value emptyObject(Json::objectValue);
   const Value emptyArray(Json::arrayValue);
 
-  auto book = std::make_unique<CB_Book>();
-  book->Read(argv[1]);
+  // One recipe at a time, in name order.
+  CB_BookFile bookFile;
+  if (!bookFile.Open(argv[1]))
+    exit(1);
+  CB_StringTableScope scope(bookFile.Get_stringTable());
 
   Value root(Json::arrayValue);
 
-  for (const CB_RecipeMap_t &recipes = book->Get_sortedByName();
-       const auto &[_, recipe] :
-#if 0
-       std::views::take(recipes, 10)
-#else
-       recipes
-#endif
-  ) {
+  const bool allRead = bookFile.ForEachRecipe([&](CB_Recipe &r) {
+    CB_Recipe *const recipe = &r;
     Value &recipeJson = root.append(emptyObject);
 
     std::string recipeName = recipe->Get_name().str();
@@ -158,6 +154,10 @@ int main(int argc, char **argv) {
     }
     Value &json_instructions = recipeJson["recipeInstructions"] = emptyArray;
     json_instructions.append(directions);
+  });
+  if (!allRead) {
+    std::cerr << argv[1] << ": cannot read all of the recipes\n";
+    exit(1);
   }
   Json::StyledStreamWriter("  ").write(std::cout, root);
 };